@@ -128,6 +128,37 @@ function activate(context) {
     context.subscriptions.push(output, formatFileCmd, formatDirCmd, formatFileManualCmd, formatDirManualCmd, compressFileCmd, compressDirCmd, runJsonTaskCmd);
 
     async function formatDocumentEdits(document, mode, context) {
+        const original = document.getText();
+        let formatted;
+        const addon = loadAddon(context, output);
+        if (addon) {
+            formatted = await addon.formatBuffer(original, mode, document.fileName);
+        } else {
+            try {
+                const server = await getServer(context, output);
+                const result = await server.request('format', { text: original, mode, name: document.fileName });
+                formatted = result.text;
+            } catch (err) {
+                // 常驻进程起不来（例如 dlfmt.path 指向不支持 --server 的旧版本）时退回临时文件的方式
+                if (!err.serverDied) throw err;
+                output.appendLine(`[警告] ${err.message}，改用临时文件格式化`);
+                return formatDocumentEditsViaFile(document, mode, context);
+            }
+        }
+
+        if (formatted === original) {
+            return [];
+        }
+        const fullRange = new vscode.Range(
+            document.positionAt(0),
+            document.positionAt(original.length)
+        );
+        return [
+            vscode.TextEdit.replace(fullRange, formatted)
+        ];
+    }
+
+    async function formatDocumentEditsViaFile(document, mode, context) {
         const tmpFile = path.join(
             os.tmpdir(),
             `dlfmt_${Date.now()}_${Math.random().toString(16).slice(2)}.lua`
@@ -188,6 +219,124 @@ function activate(context) {
     );
 }
 
+/**
+ * 常驻的 dlfmt --server 进程，按 Content-Length 分帧收发 JSON-RPC 消息
+ */
+class DlfmtServer {
+    constructor(exePath, output) {
+        this.exePath = exePath;
+        this.nextId = 1;
+        this.pending = new Map();
+        this.buffer = Buffer.alloc(0);
+        this.child = cp.spawn(exePath, ['--server'], { shell: false, windowsHide: true });
+        this.child.stdout.on('data', (d) => this._onData(d));
+        // 进程退出后的写入错误由 close 事件统一处理
+        this.child.stdin.on('error', () => { });
+        this.child.stderr.on('data', (d) => output.append(d.toString()));
+        this.child.on('error', (err) => this._dispose(err.message));
+        this.child.on('close', (code) => this._dispose(`dlfmt --server 退出代码 ${code}`));
+    }
+
+    get alive() {
+        return this.child !== null;
+    }
+
+    request(method, params) {
+        if (!this.child) {
+            return Promise.reject(Object.assign(new Error('dlfmt --server 未运行'), { serverDied: true }));
+        }
+        const id = this.nextId++;
+        const body = Buffer.from(JSON.stringify({ jsonrpc: '2.0', id, method, params }), 'utf8');
+        return new Promise((resolve, reject) => {
+            this.pending.set(id, { resolve, reject });
+            this.child.stdin.write(`Content-Length: ${body.length}\r\n\r\n`);
+            this.child.stdin.write(body);
+        });
+    }
+
+    stop() {
+        if (!this.child) return;
+        this.request('shutdown').catch(() => { });
+        this.child.stdin.end();
+    }
+
+    _onData(chunk) {
+        this.buffer = Buffer.concat([this.buffer, chunk]);
+        while (true) {
+            const headerEnd = this.buffer.indexOf('\r\n\r\n');
+            if (headerEnd < 0) return;
+            const header = this.buffer.subarray(0, headerEnd).toString('ascii');
+            const match = /Content-Length:\s*(\d+)/i.exec(header);
+            const length = match ? parseInt(match[1], 10) : 0;
+            const start = headerEnd + 4;
+            if (this.buffer.length < start + length) return;
+            const body = this.buffer.subarray(start, start + length).toString('utf8');
+            this.buffer = this.buffer.subarray(start + length);
+
+            let message;
+            try {
+                message = JSON.parse(body);
+            } catch {
+                continue;
+            }
+            const waiter = this.pending.get(message.id);
+            if (!waiter) continue;
+            this.pending.delete(message.id);
+            if (message.error) waiter.reject(new Error(message.error.message));
+            else waiter.resolve(message.result);
+        }
+    }
+
+    _dispose(reason) {
+        if (!this.child) return;
+        this.child = null;
+        for (const { reject } of this.pending.values()) {
+            reject(Object.assign(new Error(reason), { serverDied: true }));
+        }
+        this.pending.clear();
+    }
+}
+
+let _addon;
+
+/**
+ * 加载扩展内置的 Node-API 插件，在扩展宿主进程内格式化（不启动子进程、不写临时文件）。
+ * 设置了 dlfmt.path 或插件不存在、加载失败时返回 null，退回 dlfmt --server
+ */
+function loadAddon(context, output) {
+    const cfg = vscode.workspace.getConfiguration('dlfmt');
+    if ((cfg.get('path') || '').trim()) {
+        return null;
+    }
+    if (_addon === undefined) {
+        const addonPath = path.join(context.extensionPath, 'bin', `dlfmt-${process.platform}-${process.arch}.node`);
+        _addon = null;
+        if (fs.existsSync(addonPath)) {
+            try {
+                _addon = require(addonPath);
+            } catch (err) {
+                output.appendLine(`[警告] 加载 ${addonPath} 失败：${err.message}，改用 dlfmt --server`);
+            }
+        }
+    }
+    return _addon;
+}
+
+let _server = null;
+
+/**
+ * 取得常驻进程，必要时（首次使用、进程退出或 dlfmt.path 改变）重新启动
+ */
+async function getServer(context, output) {
+    const exe = await resolveDlfmtExecutable(context, output);
+    if (_server && _server.alive && _server.exePath === exe) {
+        return _server;
+    }
+    if (_server) _server.stop();
+    _server = new DlfmtServer(exe, output);
+    return _server;
+}
+
 /**
  * 解析 dlfmt 可执行路径：优先使用设置 dlfmt.path，否则使用扩展内置二进制
  * @param {vscode.ExtensionContext} context
@@ -327,7 +476,12 @@ function reportError(err, output) {
 }
 
 // This method is called when your extension is deactivated
-function deactivate() { }
+function deactivate() {
+    if (_server) {
+        _server.stop();
+        _server = null;
+    }
+}
 
 module.exports = {
     activate,
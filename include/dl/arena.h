@@ -40,6 +40,34 @@ public:
 
 	// Destroy all objects and release all memory.
 	void clear()
+	{
+		destroy_all();
+		blocks_.clear();
+		block_pos_ = 0;
+		size_      = 0;
+	}
+
+	// Destroy all objects but keep the first block, so that an arena refilled
+	// over and over with small batches does not go back to the allocator.
+	void reset()
+	{
+		if (blocks_.empty()) {
+			return;
+		}
+		destroy_all();
+		blocks_.resize(1);
+		block_pos_ = 0;
+		size_      = 0;
+	}
+
+	size_t size() const { return size_; }
+	// bool   empty() const { return size_ == 0; }
+
+	// Bytes of block storage currently held by the arena.
+	size_t memory_usage() const { return blocks_.size() * sizeof(Block); }
+
+private:
+	void destroy_all()
 	{
 		for (auto& blk : blocks_) {
 			// Only the last block may be partially filled.
@@ -49,15 +77,8 @@ public:
 				ptr->~T();
 			}
 		}
-		blocks_.clear();
-		block_pos_ = 0;
-		size_      = 0;
 	}
 
-	// size_t size() const { return size_; }
-	// bool   empty() const { return size_ == 0; }
-
-private:
 	// A block of uninitialized storage for BlockSize objects of type T.
 	struct Block
 	{
@@ -246,6 +246,33 @@ public:
 		general_else_clause_vector_arena_.clear();
 	}
 
+	/**
+	 * @brief 销毁所有节点，但每个 arena 保留第一块内存，供下一批节点复用
+	 *
+	 */
+	void Reset()
+	{
+		ast_arena_.reset();
+		token_vector_arena_.reset();
+		ast_node_vector_arena_.reset();
+		general_else_clause_vector_arena_.reset();
+	}
+
+	/**
+	 * @brief 各个 arena 当前占用的块内存之和（字节），不含 vector 自身的堆内存
+	 *
+	 * @return size_t
+	 */
+	size_t MemoryUsage() const
+	{
+		return ast_arena_.memory_usage() + token_vector_arena_.memory_usage() +
+			   ast_node_vector_arena_.memory_usage() +
+			   general_else_clause_vector_arena_.memory_usage();
+	}
+
+	// 当前分配的语法树节点数
+	size_t NodeCount() const { return ast_arena_.size(); }
+
 private:
 	Arena<AstNode, 2048>                                        ast_arena_;
 	Arena<std::vector<Token*>, 1024>                            token_vector_arena_;
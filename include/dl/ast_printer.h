@@ -1,10 +1,14 @@
 #pragma once
 #include "dl/ast.h"
 #include "dl/token.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <ostream>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace dl {
 
@@ -14,10 +18,60 @@ enum class AstPrintMode
 	Auto,
 	Manual,
 };
-template<AstPrintMode mode> class AstPrinter
+
+// 打印结果的去处：写入流，或者直接追加到内存中的字符串
+inline void write_output(std::ostream& out, const char* data, size_t size)
+{
+	out.write(data, static_cast<std::streamsize>(size));
+}
+
+inline void write_output(std::string& out, const char* data, size_t size)
+{
+	out.append(data, size);
+}
+
+/**
+ * @brief 不保存打印结果，只与 expected 逐块比较，记下第一处不同的字节
+ * @details 用于检查文件是否已经格式化：一旦不同，后续写入直接丢弃
+ */
+struct OutputComparer
+{
+	explicit OutputComparer(std::string_view expected)
+		: expected_(expected)
+	{}
+
+	// 打印结果与 expected 完全相同
+	bool Same() const noexcept { return !differs_ && matched_ == expected_.size(); }
+	bool Differs() const noexcept { return differs_; }
+
+	// 第一处不同的字节在 expected 中的偏移；打印结果是 expected 的前缀时为 expected 的长度
+	size_t Mismatch() const noexcept { return matched_; }
+
+	std::string_view expected_;
+	size_t           matched_ = 0;
+	bool             differs_ = false;
+};
+
+inline void write_output(OutputComparer& out, const char* data, size_t size)
+{
+	if (out.differs_) {
+		return;
+	}
+	const std::string_view rest = out.expected_.substr(out.matched_);
+	const size_t           n    = std::min(size, rest.size());
+	if (std::memcmp(rest.data(), data, n) == 0) {
+		out.matched_ += n;
+		out.differs_ = n < size;
+		return;
+	}
+	out.matched_ += std::mismatch(data, data + n, rest.data()).first - data;
+	out.differs_ = true;
+}
+
+template<AstPrintMode mode, typename Output = std::ostream> class AstPrinter
 {
 public:
-	AstPrinter(std::ostream& out, const std::vector<CommentToken>* comment_tokens = nullptr)
+	AstPrinter(Output& out, const std::vector<CommentToken>* comment_tokens = nullptr)
 		: out_(out)
 		, comment_tokens_(comment_tokens)
 		, indent_(0)
@@ -26,6 +80,101 @@ public:
 	void PrintAst(const AstNode* ast) noexcept
 	{
 		print_stat(ast);
+		Finish();
+	}
+
+	/**
+	 * @brief 逐条打印顶层语句，每条之后询问 stop，返回真时不再打印后面的语句
+	 * @details 配合 OutputComparer 使用：已经比出不同时，剩下的语句不必再打印。
+	 * stop 只能看到已写出的部分，所以最多晚一个缓冲区才停下
+	 *
+	 * @return bool 是否打印完整篇
+	 */
+	template<typename Stop> bool PrintAstUntil(const AstNode* ast, Stop&& stop) noexcept
+	{
+		if (ast->type_ != AstNodeType::StatList) {
+			PrintAst(ast);
+			return true;
+		}
+		for (const auto& stat : *ast->stat_list_.statement_list_) {
+			print_stat(stat);
+			if (stop()) {
+				return false;
+			}
+		}
+		Finish();
+		return true;
+	}
+
+	/**
+	 * @brief 分段打印：接着上一段打印 ast（一段顶层语句），comment_tokens 是这一段自己的注释
+	 * @details 空行分组沿用上一段最后一条语句；上一段没能输出的注释（夹在被打印成一行的语句里的）
+	 * 留到这一段第一个 token 之前输出，和整篇打印时的位置相同。结束时写出缓冲区，所有段打印完后调用 Finish
+	 *
+	 */
+	void PrintSegment(const AstNode* ast, const std::vector<CommentToken>* comment_tokens) noexcept
+	{
+		if constexpr (mode != AstPrintMode::Compress) {
+			if (comment_tokens_ != nullptr && comment_index_ < comment_tokens_->size()) {
+				// 行号记为 0，保证在下一个 token 之前全部输出
+				std::vector<CommentToken> carried;
+				carried.reserve(comment_tokens_->size() - comment_index_ + comment_tokens->size());
+				for (; comment_index_ < comment_tokens_->size(); ++comment_index_) {
+					carried.emplace_back(comment_token()->source_, 0, comment_token()->type_);
+				}
+				carried.insert(carried.end(), comment_tokens->begin(), comment_tokens->end());
+				carried_comments_.swap(carried);
+				comment_tokens_ = &carried_comments_;
+			}
+			else {
+				comment_tokens_ = comment_tokens;
+			}
+			comment_index_ = 0;
+		}
+		print_stat(ast);
+		flush();
+	}
+
+	/**
+	 * @brief 已打印的段是否留下了还没输出的注释（会被带到下一段）
+	 *
+	 */
+	bool HasPendingComments() const noexcept
+	{
+		if constexpr (mode == AstPrintMode::Compress) {
+			return false;
+		}
+		else {
+			return comment_tokens_ != nullptr && comment_index_ < comment_tokens_->size();
+		}
+	}
+
+	/**
+	 * @brief 写入一段之前打印好的结果，代替 PrintSegment
+	 * @details 只用于既没有带入、也没有留下注释的段：这时一段的结果只取决于它的源码和上一段最后一条语句的分组。
+	 * last_stat 是这一段的最后一条语句，没有语句时为空
+	 */
+	void AppendPrinted(std::string_view printed, const AstNode* last_stat) noexcept
+	{
+		flush();
+		write_output(out_, printed.data(), printed.size());
+		if (last_stat != nullptr) {
+			set_format_stat_group(get_format_stat_group(last_stat));
+		}
+		comment_tokens_ = nullptr;
+		comment_index_  = 0;
+	}
+
+	/**
+	 * @brief 输出剩余的注释并写出缓冲区
+	 *
+	 */
+	void Finish() noexcept
+	{
+		if (comment_tokens_ == nullptr) {
+			flush();
+			return;
+		}
 		if constexpr (mode == AstPrintMode::Auto) {
 			while (comment_index_ < comment_tokens_->size()) {
 				append(comment_token()->source_);
@@ -55,6 +204,33 @@ public:
 		flush();
 	}
 
+	/**
+	 * @brief 只打印语句列表 stats 中的 [begin, end)，用于区间格式化
+	 * @details 从 previous_line（前一个 token 所在行）之后的注释开始打印；Auto 模式下按 stats[begin - 1]
+	 * 的分组决定开头是否空行，与整篇打印时一致。不打印区间之后的注释
+	 *
+	 * @param indent 这些语句所在块的缩进层级
+	 * @return size_t 打印结束时消费到的注释下标，调用方据此确认区间内的注释都已输出
+	 */
+	size_t PrintStatements(const std::vector<AstNode*>& stats, size_t begin, size_t end,
+						   int indent, size_t previous_line) noexcept
+	{
+		indent_ = indent;
+		if constexpr (mode != AstPrintMode::Compress) {
+			while (comment_index_ < comment_tokens_->size() &&
+				   comment_token()->line_ <= previous_line) {
+				++comment_index_;
+			}
+			set_format_stat_group(begin > 0 ? get_format_stat_group(stats[begin - 1])
+											: FormatStatGroup::None);
+		}
+		for (size_t i = begin; i < end; ++i) {
+			print_stat(stats[i]);
+		}
+		flush();
+		return comment_index_;
+	}
+
 private:
 	enum class FormatStatGroup
 	{
@@ -131,7 +307,7 @@ private:
 		else if (type == AstNodeType::SubExpr) {
 			print_expr(expr->sub_expr_.lhs_);
 			if constexpr (mode == AstPrintMode::Compress) {
-				append('-');
+				compress_binop("-", expr->sub_expr_.lhs_, expr->sub_expr_.rhs_);
 			}
 			else {
 				append(" - ");
@@ -184,7 +360,7 @@ private:
 		else if (type == AstNodeType::ConcatExpr) {
 			print_expr(expr->concat_expr_.lhs_);
 			if constexpr (mode == AstPrintMode::Compress) {
-				append("..");
+				compress_binop("..", expr->concat_expr_.lhs_, expr->concat_expr_.rhs_);
 			}
 			else {
 				append(" .. ");
@@ -277,6 +453,10 @@ private:
 		}
 		else if (type == AstNodeType::NegativeExpr) {
 			print_token(expr->first_token_);
+			// - -x 不能连写成 --x，那是注释
+			if (expr->negative_expr_.rhs_->type_ == AstNodeType::NegativeExpr) {
+				space();
+			}
 			print_expr(expr->negative_expr_.rhs_);
 		}
 		else if (type == AstNodeType::NumberLiteral || type == AstNodeType::StringLiteral ||
@@ -323,7 +503,7 @@ private:
 				append(')');
 			}
 			else if (call_type == AstNodeType::TableCall) {
-				print_expr(expr->table_call_.table_expr_);
+				print_expr(function_args->table_call_.table_expr_);
 			}
 		}
 		else if (type == AstNodeType::CallExpr) {
@@ -850,6 +1030,42 @@ private:
 		append(tabs, indent_);
 	}
 	void space() noexcept { append(' '); }
+	/**
+	 * @brief 压缩模式下输出二元运算符，在会与两侧粘连成别的 token 的地方补一个空格
+	 * @details `-` 后接以 `-` 开头的右侧会变成注释（`1--2`）；数字之后的 `..` 会被读进数字（`1..2`），
+	 * `..` 之后以 `.` 开头的数字会与其拼成 `...`（`a...5`）
+	 */
+	void compress_binop(std::string_view op, const AstNode* lhs, const AstNode* rhs) noexcept
+	{
+		if (op.front() == '.' && ends_with_number(lhs)) {
+			space();
+		}
+		append(op);
+		const std::string_view next = rhs->first_token_->source_;
+		if (!next.empty() && next.front() == op.back() && (op.back() == '-' || op.back() == '.')) {
+			space();
+		}
+	}
+	// 表达式最右侧的 token 是否为数字字面量
+	static bool ends_with_number(const AstNode* expr) noexcept
+	{
+		while (true) {
+			const auto type = expr->type_;
+			if (type == AstNodeType::NumberLiteral) {
+				return true;
+			}
+			// 二元、一元表达式的成员布局相同，可以统一按 add_expr_ / negative_expr_ 取右侧
+			if (type >= AstNodeType::AddExpr && type <= AstNodeType::OrExpr) {
+				expr = expr->add_expr_.rhs_;
+			}
+			else if (type >= AstNodeType::NotExpr && type <= AstNodeType::LengthExpr) {
+				expr = expr->negative_expr_.rhs_;
+			}
+			else {
+				return false;
+			}
+		}
+	}
 	/**
 	 * @brief Break line, and set line_start_ to true in non-compress mode
 	 *
@@ -917,7 +1133,7 @@ private:
 
 	void flush() noexcept
 	{
-		out_.write(buffer_, buffer_pos_);
+		write_output(out_, buffer_, buffer_pos_);
 		buffer_pos_ = 0;
 	}
 
@@ -949,12 +1165,14 @@ private:
 
 	// 64 KB buffer size
 	static constexpr size_t          BUFFERSIZE = 64 * 1024;
-	std::ostream&                    out_;
+	Output&                          out_;
 	char                             buffer_[BUFFERSIZE];
 	size_t                           buffer_pos_     = 0;
 	std::size_t                      line_           = 1;
 	std::size_t                      comment_index_  = 0;
 	const std::vector<CommentToken>* comment_tokens_ = nullptr;
+	// PrintSegment 时上一段剩下的注释加上这一段的注释
+	std::vector<CommentToken>        carried_comments_;
 	int                              indent_;
 	FormatStatGroup                  last_format_stat_group_ = FormatStatGroup::None;
 	bool                             line_start_             = true;
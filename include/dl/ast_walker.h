@@ -0,0 +1,129 @@
+#pragma once
+#include "dl/ast.h"
+
+namespace dl {
+/**
+ * @brief 依次对 node 的每个直接子节点调用 f(const AstNode*)
+ * @details 二元与一元表达式的各个结构体布局相同（lhs_, rhs_ / rhs_），按联合体的公共初始序列统一访问
+ *
+ * @param node
+ * @param f
+ */
+template<typename F> void for_each_child(const AstNode* node, F&& f)
+{
+	switch (node->type_) {
+	case AstNodeType::ParenExpr: f(node->paren_expr_.expression_); break;
+	case AstNodeType::TableLiteral:
+		for (const auto& entry : node->table_literal_.entry_list_) {
+			switch (entry.type_) {
+			case AstNode::TableEntryType::Index:
+				f(entry.index_entry_.index_);
+				f(entry.index_entry_.value_);
+				break;
+			case AstNode::TableEntryType::Field: f(entry.field_entry_.value_); break;
+			case AstNode::TableEntryType::Value: f(entry.value_entry_.value_); break;
+			}
+		}
+		break;
+	case AstNodeType::FunctionLiteral: f(node->function_literal_.body_); break;
+	case AstNodeType::FunctionStat: f(node->function_stat_.body_); break;
+	case AstNodeType::ArgCall:
+		for (const auto* arg : *node->arg_call_.arg_list_) {
+			f(arg);
+		}
+		break;
+	case AstNodeType::TableCall: f(node->table_call_.table_expr_); break;
+	case AstNodeType::FieldExpr: f(node->field_expr_.base_); break;
+	case AstNodeType::MethodExpr:
+		f(node->method_expr_.base_);
+		f(node->method_expr_.function_arguments_);
+		break;
+	case AstNodeType::IndexExpr:
+		f(node->index_expr_.base_);
+		f(node->index_expr_.index_);
+		break;
+	case AstNodeType::CallExpr:
+		f(node->call_expr_.base_);
+		f(node->call_expr_.function_arguments_);
+		break;
+	case AstNodeType::AddExpr:
+	case AstNodeType::SubExpr:
+	case AstNodeType::MulExpr:
+	case AstNodeType::DivExpr:
+	case AstNodeType::PowExpr:
+	case AstNodeType::ModExpr:
+	case AstNodeType::ConcatExpr:
+	case AstNodeType::EqExpr:
+	case AstNodeType::NeqExpr:
+	case AstNodeType::LtExpr:
+	case AstNodeType::LeExpr:
+	case AstNodeType::GtExpr:
+	case AstNodeType::GeExpr:
+	case AstNodeType::AndExpr:
+	case AstNodeType::OrExpr:
+		f(node->add_expr_.lhs_);
+		f(node->add_expr_.rhs_);
+		break;
+	case AstNodeType::NotExpr:
+	case AstNodeType::NegativeExpr:
+	case AstNodeType::LengthExpr: f(node->not_expr_.rhs_); break;
+	case AstNodeType::CallExprStat: f(node->call_expr_stat_.expression_); break;
+	case AstNodeType::AssignmentStat:
+		for (const auto* lhs : *node->assignment_stat_.lhs_) {
+			f(lhs);
+		}
+		for (const auto* rhs : *node->assignment_stat_.rhs_) {
+			f(rhs);
+		}
+		break;
+	case AstNodeType::IfStat:
+		f(node->if_stat_.condition_);
+		f(node->if_stat_.body_);
+		for (const auto& clause : *node->if_stat_.else_clauses_) {
+			if (clause.type_ == AstNode::ElseClauseType::ElseIfClause) {
+				f(clause.else_if_clause_.condition_);
+			}
+			f(clause.body_);
+		}
+		break;
+	case AstNodeType::DoStat: f(node->do_stat_.body_); break;
+	case AstNodeType::WhileStat:
+		f(node->while_stat_.condition_);
+		f(node->while_stat_.body_);
+		break;
+	case AstNodeType::NumericForStat:
+		for (const auto* range : *node->numeric_for_stat_.range_list_) {
+			f(range);
+		}
+		f(node->numeric_for_stat_.body_);
+		break;
+	case AstNodeType::GenericForStat:
+		for (const auto* generator : *node->generic_for_stat_.generator_list_) {
+			f(generator);
+		}
+		f(node->generic_for_stat_.body_);
+		break;
+	case AstNodeType::RepeatStat:
+		f(node->repeat_stat_.body_);
+		f(node->repeat_stat_.condition_);
+		break;
+	case AstNodeType::LocalFunctionStat: f(node->local_function_stat_.function_stat_); break;
+	case AstNodeType::LocalVarStat:
+		for (const auto* expr : *node->local_var_stat_.expr_list_) {
+			f(expr);
+		}
+		break;
+	case AstNodeType::ReturnStat:
+		for (const auto* expr : *node->return_stat_.expr_list_) {
+			f(expr);
+		}
+		break;
+	case AstNodeType::StatList:
+		for (const auto* stat : *node->stat_list_.statement_list_) {
+			f(stat);
+		}
+		break;
+	default: break;
+	}
+}
+}   // namespace dl
@@ -0,0 +1,56 @@
+#ifndef DLFMT_H
+#define DLFMT_H
+/*
+ * libdlfmt 的 C ABI，供其它语言或进程内嵌入使用。
+ * 所有函数都是线程安全的；返回的缓冲区由库分配，须用 dlfmt_free 释放。
+ */
+#include <stddef.h>
+
+#if defined(_WIN32)
+#	if defined(DLFMT_BUILDING_LIBRARY)
+#		define DLFMT_API __declspec(dllexport)
+#	else
+#		define DLFMT_API __declspec(dllimport)
+#	endif
+#else
+#	define DLFMT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum dlfmt_format_mode
+{
+	DLFMT_MODE_AUTO     = 0,
+	DLFMT_MODE_MANUAL   = 1,
+	DLFMT_MODE_COMPRESS = 2
+} dlfmt_format_mode;
+
+typedef enum dlfmt_status
+{
+	DLFMT_OK               = 0,
+	DLFMT_SYNTAX_ERROR     = 1,
+	DLFMT_INVALID_ARGUMENT = 2,
+	DLFMT_INTERNAL_ERROR   = 3
+} dlfmt_status;
+
+/*
+ * 格式化或压缩 input[0, input_size)。
+ * 成功时 *output / *output_size 为结果（以 '\0' 结尾，output_size 不含结尾）；
+ * 失败时 *output 为 NULL，若 error 非 NULL 则 *error 为错误说明，同样须用 dlfmt_free 释放。
+ * name 只用于错误信息，可以为 NULL。
+ */
+DLFMT_API dlfmt_status dlfmt_format_buffer(const char* input, size_t input_size,
+										   dlfmt_format_mode mode, const char* name, char** output,
+										   size_t* output_size, char** error);
+
+DLFMT_API void dlfmt_free(char* buffer);
+
+DLFMT_API const char* dlfmt_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
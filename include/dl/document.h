@@ -0,0 +1,59 @@
+#pragma once
+#include "dl/formatter.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace dl {
+/**
+ * @brief 常驻进程（编辑器、监视模式）里反复编辑、反复格式化的一份源码
+ * @details 源码在顶层语句之间的行尾切成若干段，每段各自分词、解析，语法树分配在按批次划分的
+ * AstManager 里。Edit 只把与编辑相交的段合并为待解析段；Format 时从待解析段开始重新分词、解析，
+ * 解析失败，或与相邻段接不上（下一段以 `(` 开头、上一段以 return / break 结尾）时向两侧合并更多的段，
+ * 其余段的 token 与语法树原样复用。每段的打印结果按源码哈希与上一条语句的分组缓存，
+ * 没有改动的段直接复制。格式化结果与 Formatter::Format 整篇处理一致。
+ * 不是线程安全的
+ */
+class Document
+{
+public:
+	Document(std::string text, const FormatOptions& options);
+	~Document();
+	Document(Document&&) noexcept;
+	Document& operator=(Document&&) noexcept;
+
+	/**
+	 * @brief 把 [offset, offset + length) 替换为 text，推迟到 Format 时再解析
+	 * @note 区间超出文本时抛出 std::out_of_range
+	 */
+	void Edit(size_t offset, size_t length, std::string_view text);
+
+	/**
+	 * @brief 重新解析待解析的段，把整篇结果写入 output（覆盖原内容）
+	 * @details 语法错误以 SyntaxError 抛出，行号按整篇计；出错后文档不变，可以继续编辑
+	 */
+	void Format(std::string& output);
+
+	// 当前的完整源码
+	std::string Text() const;
+	size_t      Size() const noexcept;
+
+	/**
+	 * @brief 最近一次 Format 重新分词的字节数，用于观察增量解析的效果
+	 *
+	 */
+	size_t ReparsedBytes() const noexcept;
+
+	/**
+	 * @brief 最近一次 Format 实际重新打印的输出字节数，其余段直接复制上次的打印结果
+	 *
+	 */
+	size_t ReprintedBytes() const noexcept;
+
+	class Impl;
+
+private:
+	std::unique_ptr<Impl> impl_;
+};
+}   // namespace dl
@@ -0,0 +1,80 @@
+#pragma once
+#include "dl/syntax_error.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dl {
+enum class FormatMode
+{
+	Auto,
+	Manual,
+	Compress
+};
+
+struct FormatOptions
+{
+	FormatMode mode = FormatMode::Auto;
+	// 只用于报错信息
+	std::string name = "<buffer>";
+};
+
+/**
+ * @brief 把 [offset, offset + length) 替换为 text
+ *
+ */
+struct TextEdit
+{
+	size_t      offset = 0;
+	size_t      length = 0;
+	std::string text;
+};
+
+/**
+ * @brief 内存中的格式化 / 压缩接口，供嵌入 dl_core 的程序使用
+ * @details 不读写文件、不打日志、不持有共享状态，可以在多个线程里同时调用。
+ * 语法错误以 SyntaxError 抛出
+ */
+class Formatter
+{
+public:
+	/**
+	 * @brief 处理 input，结果写入 output（覆盖原内容，复用其容量）
+	 *
+	 */
+	static void Format(std::string_view input, const FormatOptions& options, std::string& output);
+
+	/**
+	 * @brief 同上，分词器直接接管 input，省去一次拷贝
+	 *
+	 */
+	static void Format(std::string&& input, const FormatOptions& options, std::string& output);
+
+	static std::string Format(std::string_view input, const FormatOptions& options = {});
+
+	/**
+	 * @brief 区间格式化：只重新打印与 input[begin, end) 相交的最内层语句，返回替换它们所在各行的编辑
+	 * @details 语句按所在块的层级缩进，开头的空行按前一条语句的分组决定，与整篇格式化的结果一致。
+	 * 选中的语句与块的开头 / 结尾同行，或注释跨过了区间边界时，改为选中外层语句。
+	 * 区间内没有语句时返回空编辑（length 为 0、text 为空）；不支持 Compress 模式
+	 *
+	 */
+	static TextEdit FormatRange(std::string_view input, size_t begin, size_t end,
+								const FormatOptions& options);
+
+	struct BatchResult
+	{
+		std::string output;
+		// 为空表示成功，否则是 SyntaxError::what()
+		std::string error;
+	};
+
+	/**
+	 * @brief 用 OpenMP 并行处理一批输入，results 与 inputs 一一对应。单个输入出错不影响其它输入
+	 *
+	 */
+	static void FormatBatch(const std::vector<std::string_view>& inputs,
+							const FormatOptions& options, std::vector<BatchResult>& results);
+};
+}   // namespace dl
@@ -5,6 +5,7 @@
 #include "dl/ast_manager.h"
 #include "dl/token.h"
 #include <cstddef>
+#include <string>
 #include <vector>
 namespace dl {
 #define UNARY_PRIORITY 8
@@ -12,16 +13,38 @@ class Parser
 {
 public:
 	Parser(std::vector<Token>& tokens, const std::string& file_name);
+	/**
+	 * @brief 语法树分配在外部的 ast_manager 里，Parser 析构后仍然有效
+	 * @details 供分段解析的 Document 使用：多段语句共用一代 AstManager
+	 */
+	Parser(std::vector<Token>& tokens, const std::string& file_name, AstManager& ast_manager);
+	/**
+	 * @brief 只检查语法，不保留语法树
+	 * @details 逐条解析顶层语句，每条之后重置 AstManager，语法树占用的内存只取决于最大的一条顶层语句。
+	 * 语法错误以 SyntaxError 抛出
+	 */
+	static void Validate(std::vector<Token>& tokens, const std::string& file_name);
 	AstNode* GetAstRoot() noexcept { return ast_root_; }
+	/**
+	 * @brief 语法树占用的内存估计（字节）
+	 *
+	 * @return size_t
+	 */
+	size_t MemoryUsage() const noexcept { return ast_manager_.MemoryUsage(); }
+	// 语法树的节点数
+	size_t NodeCount() const noexcept { return ast_manager_.NodeCount(); }
 
 private:
+	Parser(std::vector<Token>& tokens, const std::string& file_name, AstManager& ast_manager,
+		   bool validate_only);
 	// 获得当前位置的 token，并将位置后移一位
 	[[nodiscard]] Token* get() noexcept;
 	[[nodiscard]] Token* peek(size_t offset) const noexcept;
     [[nodiscard]] Token* peek() const noexcept;
 	void                 step() noexcept;
 	void                 step_trust_me() noexcept;
-	std::string          get_token_start_position(const Token* token) const noexcept;
+	// 在 token 处抛出 SyntaxError
+	[[noreturn]] void    throw_error(const Token* token, const std::string& message) const;
 	bool                 is_block_follow() const noexcept;
 
 	/**
@@ -247,7 +270,11 @@ private:
 	size_t              position_;
 	std::vector<Token>& tokens_;
 	AstNode*            ast_root_;
-	AstManager          ast_manager_;
+	// 未传入外部 AstManager 时使用
+	AstManager          own_ast_manager_;
+	AstManager&         ast_manager_;
 	bool                reached_eof_;
+	// 越过最后一个 token 后 peek / get 返回它，避免把最后一个 token 再读一遍
+	mutable Token       eof_token_;
 };
 }   // namespace dl
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace dl {
+/**
+ * @brief 分词或解析失败时抛出，what() 形如 "file:line: 说明"
+ * @details 分词器与解析器本身不再打日志，由调用方决定如何报告
+ */
+class SyntaxError : public std::runtime_error
+{
+public:
+	SyntaxError(const std::string& file_name, size_t line, const std::string& message)
+		: std::runtime_error(file_name + ":" + std::to_string(line) + ": " + message)
+		, file_name_(file_name)
+		, line_(line)
+		, message_(message)
+	{}
+
+	const std::string& FileName() const noexcept { return file_name_; }
+	size_t             Line() const noexcept { return line_; }
+	const std::string& Message() const noexcept { return message_; }
+
+private:
+	std::string file_name_;
+	size_t      line_;
+	std::string message_;
+};
+}   // namespace dl
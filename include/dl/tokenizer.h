@@ -1,4 +1,5 @@
 #pragma once
+#include "dl/syntax_error.h"
 #include "dl/token.h"
 #include <cstdarg>
 #include <magic_enum/magic_enum.hpp>
@@ -55,6 +56,18 @@ public:
 #endif
 	std::vector<Token>&        getTokens() noexcept { return tokens_; }
 	std::vector<CommentToken>& getCommentTokens() noexcept { return comment_tokens_; }
+	const std::string&         getText() const noexcept { return text_; }
+
+	/**
+	 * @brief 分词器持有的内存估计（源码 + token 表 + 注释表），单位字节
+	 *
+	 * @return size_t
+	 */
+	size_t MemoryUsage() const noexcept
+	{
+		return text_.capacity() + tokens_.capacity() * sizeof(Token) +
+			   comment_tokens_.capacity() * sizeof(CommentToken);
+	}
 
 private:
 	// 查看当前位置往前看第offset个字符
@@ -500,27 +513,26 @@ private:
 		}
 	}
 
-	// 接收类似于 printf 接收的参数
+	// 接收类似于 printf 接收的参数，抛出 SyntaxError
 	void error(const char* fmt, ...) const
 	{
-		SPDLOG_ERROR("Tokenizer Error at {}:{}", file_name_, line_);
 		char    buf[512];
 		va_list args;
 		va_start(args, fmt);
 		vsnprintf(buf, sizeof(buf), fmt, args);
 		va_end(args);
 
-		SPDLOG_ERROR("{}", buf);
-
-		// 尝试打印上一条 token 和 这一条 token
+		std::string message = buf;
+		// 附上上一条 token，便于定位
 		if (!tokens_.empty()) {
 			const Token& last_token = tokens_.back();
-			SPDLOG_ERROR("Last Token: Type: {}, Text: {}",
-						 std::string(magic_enum::enum_name(last_token.type_)),
-						 last_token.source_);
+			message += " (last token: ";
+			message += magic_enum::enum_name(last_token.type_);
+			message += " '";
+			message += last_token.source_;
+			message += "')";
 		}
-
-		throw std::runtime_error("Tokenizer Error");
+		throw SyntaxError(file_name_, line_, message);
 	}
 
 	std::string               file_name_;
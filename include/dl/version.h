@@ -0,0 +1,6 @@
+#pragma once
+
+namespace dl {
+// dlfmt 的版本号，同时是增量缓存与结果缓存键的一部分，输出格式变化时必须更新
+inline constexpr const char* VERSION = "0.1.2";
+}   // namespace dl
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace dl {
+
+// xxHash64 (https://github.com/Cyan4973/xxHash), used for cache keys and content comparison.
+// Results are identical to the reference XXH64 on little-endian hosts.
+namespace xxhash_detail {
+constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) noexcept
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char* p) noexcept
+{
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t read32(const unsigned char* p) noexcept
+{
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) noexcept
+{
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val) noexcept
+{
+	acc ^= round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+}   // namespace xxhash_detail
+
+inline uint64_t xxhash64(const void* data, size_t length, uint64_t seed = 0) noexcept
+{
+	using namespace xxhash_detail;
+	const auto* p   = static_cast<const unsigned char*>(data);
+	const auto* end = p + length;
+	uint64_t    h;
+
+	if (length >= 32) {
+		const auto* limit = end - 32;
+		uint64_t    v1    = seed + PRIME1 + PRIME2;
+		uint64_t    v2    = seed + PRIME2;
+		uint64_t    v3    = seed;
+		uint64_t    v4    = seed - PRIME1;
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	}
+	else {
+		h = seed + PRIME5;
+	}
+
+	h += static_cast<uint64_t>(length);
+
+	while (p + 8 <= end) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= static_cast<uint64_t>(*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+		++p;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+inline uint64_t xxhash64(std::string_view data, uint64_t seed = 0) noexcept
+{
+	return xxhash64(data.data(), data.size(), seed);
+}
+
+}   // namespace dl
@@ -0,0 +1,443 @@
+#include "dl/document.h"
+#include "dl/ast_manager.h"
+#include "dl/ast_printer.h"
+#include "dl/parser.h"
+#include "dl/tokenizer.h"
+#include "dl/xxhash.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using namespace dl;
+
+class Document::Impl
+{
+public:
+	virtual ~Impl() = default;
+
+	virtual void        Edit(size_t offset, size_t length, std::string_view text) = 0;
+	virtual void        Format(std::string& output)                               = 0;
+	virtual std::string Text() const                                              = 0;
+	virtual size_t      Size() const noexcept                                     = 0;
+	virtual size_t      ReparsedBytes() const noexcept                            = 0;
+	virtual size_t      ReprintedBytes() const noexcept                           = 0;
+};
+
+namespace {
+// 同时存活的 AstManager 批次上限，超过后整篇重新解析一次，释放零散的旧批次
+constexpr size_t MAX_GENERATIONS = 64;
+
+/**
+ * @brief 从 position 起看这一行剩下的内容，返回行尾 '\n' 的位置（没有换行时为文本末尾）
+ * @details 只允许空白与不跨行的注释，这样在行尾切开后两边各自分词的结果与合在一起相同；
+ * 否则返回 npos
+ */
+size_t line_end_after(std::string_view text, size_t position) noexcept
+{
+	while (position < text.size()) {
+		const char c = text[position];
+		if (c == '\n') {
+			return position;
+		}
+		if (c == ' ' || c == '\t' || c == '\r') {
+			++position;
+			continue;
+		}
+		if (c != '-' || position + 1 >= text.size() || text[position + 1] != '-') {
+			return std::string_view::npos;
+		}
+		position += 2;
+		// 长注释 --[==[ ... ]==]
+		if (position < text.size() && text[position] == '[') {
+			size_t level_end = position + 1;
+			while (level_end < text.size() && text[level_end] == '=') {
+				++level_end;
+			}
+			if (level_end < text.size() && text[level_end] == '[') {
+				const std::string close = "]" + std::string(level_end - position - 1, '=') + "]";
+				const size_t      close_position = text.find(close, level_end + 1);
+				if (close_position == std::string_view::npos ||
+					text.substr(position, close_position - position).find('\n') !=
+						std::string_view::npos) {
+					return std::string_view::npos;
+				}
+				position = close_position + close.size();
+				continue;
+			}
+		}
+		// 短注释直到行尾
+		return std::min(text.find('\n', position), text.size());
+	}
+	return text.size();
+}
+
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+class SegmentedDocument final : public Document::Impl
+{
+public:
+	SegmentedDocument(std::string&& text, const std::string& name)
+		: name_(name)
+	{
+		segments_.emplace_back();
+		segments_.back().text = std::move(text);
+		UpdateStarts();
+	}
+
+	void Edit(size_t offset, size_t length, std::string_view text) override
+	{
+		const size_t size = starts_.back();
+		if (offset > size || length > size - offset) {
+			throw std::out_of_range("Edit range is outside of the document");
+		}
+		// 编辑落在段首（即上一段最后一行的行尾）时，也可能接到上一条语句后面
+		size_t first = SegmentAt(offset);
+		if (first > 0 && starts_[first] == offset) {
+			--first;
+		}
+		const size_t last   = SegmentAt(offset + length);
+		std::string  merged = Concat(first, last);
+		merged.replace(offset - starts_[first], length, text.data(), text.size());
+
+		std::vector<Segment> pending(1);
+		pending.front().text = std::move(merged);
+		Replace(first, last, std::move(pending));
+	}
+
+	void Format(std::string& output) override
+	{
+		reparsed_bytes_ = 0;
+		if (LiveGenerations() > MAX_GENERATIONS) {
+			std::vector<Segment> pending(1);
+			pending.front().text = Concat(0, segments_.size() - 1);
+			Replace(0, segments_.size() - 1, std::move(pending));
+		}
+		for (size_t i = 0; i < segments_.size(); ++i) {
+			if (!segments_[i].tokenizer) {
+				i = Reparse(i);
+			}
+		}
+
+		output.clear();
+		output.reserve(Size() + Size() / 4);
+		reprinted_bytes_ = 0;
+		AstPrinter<print_mode, std::string> printer(output);
+		const AstNode*                      previous = nullptr;
+		for (auto& segment : segments_) {
+			const auto&    stats   = *segment.root->stat_list_.statement_list_;
+			const AstNode* last    = stats.empty() ? previous : stats.back();
+			const uint64_t context = previous ? static_cast<uint64_t>(previous->type_) + 1 : 0;
+			const bool     carried = printer.HasPendingComments();
+			if (!carried) {
+				// 新解析出来的段：被替换掉的段里可能有源码相同的
+				if (!segment.has_printed || segment.printed_context != context) {
+					const auto it = retired_.find(PrintedKey(segment.hash, context));
+					if (it != retired_.end()) {
+						segment.printed         = std::move(it->second);
+						segment.printed_context = context;
+						segment.has_printed     = true;
+						retired_.erase(it);
+					}
+				}
+				if (segment.has_printed && segment.printed_context == context) {
+					printer.AppendPrinted(segment.printed, stats.empty() ? nullptr : last);
+					previous = last;
+					continue;
+				}
+			}
+
+			const size_t begin = output.size();
+			printer.PrintSegment(segment.root, &segment.tokenizer->getCommentTokens());
+			reprinted_bytes_ += output.size() - begin;
+			segment.has_printed = !carried && !printer.HasPendingComments();
+			if (segment.has_printed) {
+				segment.printed.assign(output, begin, std::string::npos);
+				segment.printed_context = context;
+			}
+			previous = last;
+		}
+		printer.Finish();
+		retired_.clear();
+	}
+
+	std::string Text() const override { return Concat(0, segments_.size() - 1); }
+	size_t      Size() const noexcept override { return starts_.back(); }
+	size_t      ReparsedBytes() const noexcept override { return reparsed_bytes_; }
+	size_t      ReprintedBytes() const noexcept override { return reprinted_bytes_; }
+
+private:
+	struct Segment
+	{
+		// 待解析时源码在 text 里，解析后交给 tokenizer 持有
+		std::string                               text;
+		std::unique_ptr<Tokenizer<tokenize_mode>> tokenizer;
+		const AstNode*                            root = nullptr;
+		// 源码的哈希
+		uint64_t hash = 0;
+		// 上次的打印结果，只在上一条顶层语句的类型（printed_context）相同、前后都没有带过注释时可以复用
+		std::string printed;
+		uint64_t    printed_context = 0;
+		bool        has_printed     = false;
+		// 语法树所在的批次，最后一个引用它的段被替换时释放
+		std::shared_ptr<AstManager> generation;
+
+		const std::string& Source() const noexcept
+		{
+			return tokenizer ? tokenizer->getText() : text;
+		}
+	};
+
+	/**
+	 * @brief 从待解析的段 index 开始解析，失败时向两侧成倍合并更多的段，直到整篇
+	 *
+	 * @return size_t 解析出的最后一段的下标
+	 */
+	size_t Reparse(size_t index)
+	{
+		size_t first = index;
+		size_t last  = index;
+		size_t step  = 1;
+		while (true) {
+			std::vector<Segment> built;
+			try {
+				built = Build(first, last);
+			}
+			catch (const SyntaxError&) {
+				if (first == 0 && last + 1 == segments_.size()) {
+					throw;
+				}
+				first = first > step ? first - step : 0;
+				last  = std::min(last + step, segments_.size() - 1);
+				step *= 2;
+				continue;
+			}
+			// 只有注释的段不单独存在，否则判断不了前后两条语句能否分开解析
+			if (built.front().tokenizer->getTokens().empty() && segments_.size() > 1 &&
+				!(first == 0 && last + 1 == segments_.size())) {
+				if (last + 1 < segments_.size()) {
+					++last;
+				}
+				else {
+					--first;
+				}
+				continue;
+			}
+			if (first > 0 && !Joinable(segments_[first - 1], built.front())) {
+				--first;
+				continue;
+			}
+			// 后面待解析的段轮到它时再检查
+			if (last + 1 < segments_.size() && segments_[last + 1].tokenizer &&
+				!Joinable(built.back(), segments_[last + 1])) {
+				++last;
+				continue;
+			}
+			const size_t count = built.size();
+			Replace(first, last, std::move(built));
+			return first + count - 1;
+		}
+	}
+
+	/**
+	 * @brief 解析 [first, last] 合在一起的源码，再在顶层语句之间能安全切开的行尾拆成多段
+	 * @details 拆开后每段重新分词、解析一次，之后的编辑只需重新解析其中一段
+	 */
+	std::vector<Segment> Build(size_t first, size_t last)
+	{
+		Segment              whole = Parse(Concat(first, last), NewGeneration());
+		std::vector<Segment> built;
+
+		const auto&         source = whole.tokenizer->getText();
+		const auto&         stats  = *whole.root->stat_list_.statement_list_;
+		std::vector<size_t> cuts{0};
+		for (size_t k = 1; k < stats.size(); ++k) {
+			// 以 ( 开头的语句单独解析时可能被当成上一条语句的调用参数
+			const Token* next = stats[k]->first_token_;
+			if (next->source_ == "(") {
+				continue;
+			}
+			const Token* previous = next - 1;
+			const size_t cut      = line_end_after(
+                source,
+                static_cast<size_t>(previous->source_.data() + previous->source_.size() -
+                                    source.data()));
+			if (cut < source.size()) {
+				cuts.push_back(cut);
+			}
+		}
+		if (cuts.size() == 1) {
+			built.push_back(std::move(whole));
+			return built;
+		}
+
+		cuts.push_back(source.size());
+		auto generation = NewGeneration();
+		for (size_t k = 0; k + 1 < cuts.size(); ++k) {
+			built.push_back(Parse(source.substr(cuts[k], cuts[k + 1] - cuts[k]), generation));
+		}
+		return built;
+	}
+
+	Segment Parse(std::string&& text, std::shared_ptr<AstManager> generation)
+	{
+		reparsed_bytes_ += text.size();
+		Segment segment;
+		segment.generation = std::move(generation);
+		segment.tokenizer  = std::make_unique<Tokenizer<tokenize_mode>>(std::move(text), name_);
+		Parser parser(segment.tokenizer->getTokens(), name_, *segment.generation);
+		segment.root = parser.GetAstRoot();
+		segment.hash = xxhash64(segment.tokenizer->getText());
+		return segment;
+	}
+
+	/**
+	 * @brief previous 与 next 分开解析的结果与合在一起解析相同
+	 *
+	 */
+	static bool Joinable(const Segment& previous, const Segment& next) noexcept
+	{
+		const auto& tokens = next.tokenizer->getTokens();
+		if (tokens.empty()) {
+			return true;
+		}
+		// return / break 之后不能再有语句
+		const auto& stats = *previous.root->stat_list_.statement_list_;
+		if (!stats.empty() && (stats.back()->type_ == AstNodeType::ReturnStat ||
+							   stats.back()->type_ == AstNodeType::BreakStat)) {
+			return false;
+		}
+		return tokens.front().source_ != "(";
+	}
+
+	static uint64_t PrintedKey(uint64_t hash, uint64_t context) noexcept
+	{
+		return hash ^ (context * 0x9E3779B97F4A7C15ULL);
+	}
+
+	std::shared_ptr<AstManager> NewGeneration()
+	{
+		auto generation = std::make_shared<AstManager>();
+		generations_.push_back(generation);
+		return generation;
+	}
+
+	size_t LiveGenerations()
+	{
+		generations_.erase(std::remove_if(generations_.begin(),
+										  generations_.end(),
+										  [](const std::weak_ptr<AstManager>& generation) {
+											  return generation.expired();
+										  }),
+						   generations_.end());
+		return generations_.size();
+	}
+
+	// 包含 offset 的段；offset 为文本末尾时是最后一段
+	size_t SegmentAt(size_t offset) const noexcept
+	{
+		return static_cast<size_t>(
+				   std::upper_bound(starts_.begin(), starts_.end() - 1, offset) - starts_.begin()) -
+			   1;
+	}
+
+	std::string Concat(size_t first, size_t last) const
+	{
+		std::string text;
+		text.reserve(starts_[last + 1] - starts_[first]);
+		for (size_t i = first; i <= last; ++i) {
+			text += segments_[i].Source();
+		}
+		return text;
+	}
+
+	// 用 replacement 替换 [first, last] 这几段
+	void Replace(size_t first, size_t last, std::vector<Segment>&& replacement)
+	{
+		// 被替换的段的打印结果留给重新解析出的、源码相同的段
+		for (size_t i = first; i <= last; ++i) {
+			auto& segment = segments_[i];
+			if (segment.has_printed) {
+				retired_[PrintedKey(segment.hash, segment.printed_context)] =
+					std::move(segment.printed);
+			}
+		}
+		segments_.erase(segments_.begin() + static_cast<std::ptrdiff_t>(first),
+						segments_.begin() + static_cast<std::ptrdiff_t>(last + 1));
+		segments_.insert(segments_.begin() + static_cast<std::ptrdiff_t>(first),
+						 std::make_move_iterator(replacement.begin()),
+						 std::make_move_iterator(replacement.end()));
+		UpdateStarts();
+	}
+
+	void UpdateStarts()
+	{
+		starts_.resize(segments_.size() + 1);
+		starts_[0] = 0;
+		for (size_t i = 0; i < segments_.size(); ++i) {
+			starts_[i + 1] = starts_[i] + segments_[i].Source().size();
+		}
+	}
+
+	std::string          name_;
+	std::vector<Segment> segments_;
+	// 每段的起始偏移，末尾多一项为总长度
+	std::vector<size_t>                     starts_;
+	std::vector<std::weak_ptr<AstManager>> generations_;
+	size_t                                  reparsed_bytes_ = 0;
+	// 上次 Format 之后被替换掉的段的打印结果，键见 PrintedKey
+	std::unordered_map<uint64_t, std::string> retired_;
+	size_t                                    reprinted_bytes_ = 0;
+};
+}   // namespace
+
+Document::Document(std::string text, const FormatOptions& options)
+{
+	switch (options.mode) {
+	case FormatMode::Manual:
+		impl_ = std::make_unique<SegmentedDocument<TokenizeMode::FormatManual, AstPrintMode::Manual>>(
+			std::move(text), options.name);
+		break;
+	case FormatMode::Compress:
+		impl_ = std::make_unique<SegmentedDocument<TokenizeMode::Compress, AstPrintMode::Compress>>(
+			std::move(text), options.name);
+		break;
+	default:
+		impl_ = std::make_unique<SegmentedDocument<TokenizeMode::FormatAuto, AstPrintMode::Auto>>(
+			std::move(text), options.name);
+		break;
+	}
+}
+
+Document::~Document()                              = default;
+Document::Document(Document&&) noexcept            = default;
+Document& Document::operator=(Document&&) noexcept = default;
+
+void Document::Edit(size_t offset, size_t length, std::string_view text)
+{
+	impl_->Edit(offset, length, text);
+}
+
+void Document::Format(std::string& output)
+{
+	impl_->Format(output);
+}
+
+std::string Document::Text() const
+{
+	return impl_->Text();
+}
+
+size_t Document::Size() const noexcept
+{
+	return impl_->Size();
+}
+
+size_t Document::ReparsedBytes() const noexcept
+{
+	return impl_->ReparsedBytes();
+}
+
+size_t Document::ReprintedBytes() const noexcept
+{
+	return impl_->ReprintedBytes();
+}
@@ -0,0 +1,325 @@
+#include "dl/formatter.h"
+#include "dl/ast_printer.h"
+#include "dl/parser.h"
+#include "dl/tokenizer.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+using namespace dl;
+
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+static void ProcessBuffer(std::string&& input, const std::string& name, std::string& output)
+{
+	const size_t             input_size = input.size();
+	Tokenizer<tokenize_mode> tokenizer(std::move(input), name);
+	Parser                   parser(tokenizer.getTokens(), name);
+
+	output.clear();
+	output.reserve(input_size + input_size / 4);
+	AstPrinter<print_mode, std::string> printer(output, &tokenizer.getCommentTokens());
+	printer.PrintAst(parser.GetAstRoot());
+}
+
+void Formatter::Format(std::string&& input, const FormatOptions& options, std::string& output)
+{
+	switch (options.mode) {
+	case FormatMode::Manual:
+		ProcessBuffer<TokenizeMode::FormatManual, AstPrintMode::Manual>(
+			std::move(input), options.name, output);
+		break;
+	case FormatMode::Compress:
+		ProcessBuffer<TokenizeMode::Compress, AstPrintMode::Compress>(
+			std::move(input), options.name, output);
+		break;
+	default:
+		ProcessBuffer<TokenizeMode::FormatAuto, AstPrintMode::Auto>(
+			std::move(input), options.name, output);
+		break;
+	}
+}
+
+void Formatter::Format(std::string_view input, const FormatOptions& options, std::string& output)
+{
+	Format(std::string(input), options, output);
+}
+
+std::string Formatter::Format(std::string_view input, const FormatOptions& options)
+{
+	std::string output;
+	Format(std::string(input), options, output);
+	return output;
+}
+
+namespace {
+// 语句块：语句列表、缩进层级，以及块的结束 token（顶层为空）
+struct block_t
+{
+	const std::vector<AstNode*>* stats;
+	int                          depth;
+	const Token*                 terminator;
+};
+
+// 依次对语句的每个子块调用 f(body, terminator)，不进入表达式里的函数字面量
+template<typename F> void for_each_block(const AstNode* stat, F&& f)
+{
+	switch (stat->type_) {
+	case AstNodeType::LocalFunctionStat:
+		for_each_block(stat->local_function_stat_.function_stat_, f);
+		break;
+	case AstNodeType::FunctionStat: f(stat->function_stat_.body_, stat->function_stat_.end_token_); break;
+	case AstNodeType::DoStat: f(stat->do_stat_.body_, stat->do_stat_.end_token_); break;
+	case AstNodeType::WhileStat: f(stat->while_stat_.body_, stat->while_stat_.end_token_); break;
+	case AstNodeType::NumericForStat:
+		f(stat->numeric_for_stat_.body_, stat->numeric_for_stat_.end_token_);
+		break;
+	case AstNodeType::GenericForStat:
+		f(stat->generic_for_stat_.body_, stat->generic_for_stat_.end_token_);
+		break;
+	case AstNodeType::RepeatStat: f(stat->repeat_stat_.body_, stat->repeat_stat_.until_token_); break;
+	case AstNodeType::IfStat:
+	{
+		const auto& node    = stat->if_stat_;
+		const auto& clauses = *node.else_clauses_;
+		f(node.body_, clauses.empty() ? node.end_token_ : clauses.front().else_token_);
+		for (size_t i = 0; i < clauses.size(); ++i) {
+			f(clauses[i].body_,
+			  i + 1 < clauses.size() ? clauses[i + 1].else_token_ : node.end_token_);
+		}
+		break;
+	}
+	default: break;
+	}
+}
+
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode> class RangeFormatter
+{
+public:
+	RangeFormatter(std::string&& input, const std::string& name)
+		: tokenizer_(std::move(input), name)
+		, parser_(tokenizer_.getTokens(), name)
+		, first_token_(tokenizer_.getTokens().data())
+		, last_token_(tokenizer_.getTokens().empty() ? nullptr : &tokenizer_.getTokens().back())
+	{
+		const auto& text = tokenizer_.getText();
+		line_starts_.push_back(0);
+		for (size_t i = 0; i < text.size(); ++i) {
+			if (text[i] == '\n') {
+				line_starts_.push_back(i + 1);
+			}
+		}
+	}
+
+	TextEdit Format(size_t begin, size_t end)
+	{
+		end = std::max(end, begin + 1);
+
+		// 从顶层向下，记录每一层与区间相交的语句；区间完全落在某条语句的子块内时继续向下
+		std::vector<block_t>                   blocks;
+		std::vector<std::pair<size_t, size_t>> selections;
+		block_t block{parser_.GetAstRoot()->stat_list_.statement_list_, 0, nullptr};
+		while (true) {
+			const auto& stats = *block.stats;
+			size_t      first = stats.size();
+			size_t      last  = 0;
+			for (size_t k = 0; k < stats.size(); ++k) {
+				if (End(LastToken(block, k)) > begin && Begin(stats[k]->first_token_) < end) {
+					first = std::min(first, k);
+					last  = k;
+				}
+			}
+			if (first == stats.size()) {
+				break;
+			}
+			blocks.push_back(block);
+			selections.emplace_back(first, last);
+			if (first != last) {
+				break;
+			}
+			bool descended = false;
+			for_each_block(stats[first], [&](const AstNode* body, const Token* terminator) {
+				const auto& inner = *body->stat_list_.statement_list_;
+				if (descended || inner.empty()) {
+					return;
+				}
+				const block_t child{&inner, block.depth + 1, terminator};
+				if (begin >= Begin(inner.front()->first_token_) &&
+					end <= End(LastToken(child, inner.size() - 1))) {
+					block     = child;
+					descended = true;
+				}
+			});
+			if (!descended) {
+				break;
+			}
+		}
+		if (blocks.empty()) {
+			return TextEdit{begin, 0, std::string()};
+		}
+
+		// 由内向外，第一个能安全拼接的选择即为结果
+		for (size_t level = blocks.size(); level-- > 0;) {
+			TextEdit edit;
+			if (TryPrint(blocks[level], selections[level].first, selections[level].second, edit)) {
+				return edit;
+			}
+		}
+
+		TextEdit edit{0, tokenizer_.getText().size(), std::string()};
+		AstPrinter<print_mode, std::string> printer(edit.text, &tokenizer_.getCommentTokens());
+		printer.PrintAst(parser_.GetAstRoot());
+		return edit;
+	}
+
+private:
+	size_t Begin(const Token* token) const noexcept
+	{
+		return static_cast<size_t>(token->source_.data() - tokenizer_.getText().data());
+	}
+	size_t End(const Token* token) const noexcept { return Begin(token) + token->source_.size(); }
+
+	// 行号从 1 开始，与 token 的 line_ 一致
+	size_t LineOf(size_t offset) const noexcept
+	{
+		return static_cast<size_t>(
+			std::upper_bound(line_starts_.begin(), line_starts_.end(), offset) - line_starts_.begin());
+	}
+	size_t LineStart(size_t line) const noexcept
+	{
+		return line - 1 < line_starts_.size() ? line_starts_[line - 1] : tokenizer_.getText().size();
+	}
+
+	const Token* PreviousToken(const AstNode* stat) const noexcept
+	{
+		return stat->first_token_ == first_token_ ? nullptr : stat->first_token_ - 1;
+	}
+	// 第 k 条语句的最后一个 token：下一条语句（或块的结束 token）之前的那个
+	const Token* LastToken(const block_t& block, size_t k) const noexcept
+	{
+		const auto& stats = *block.stats;
+		if (k + 1 < stats.size()) {
+			return stats[k + 1]->first_token_ - 1;
+		}
+		return block.terminator ? block.terminator - 1 : last_token_;
+	}
+
+	/**
+	 * @brief 打印块中第 first 到 last 条语句，替换从前一个 token 的下一行到最后一个 token 所在行
+	 *
+	 * @return false 选中的语句与块的开头 / 结尾同行，或注释无法完整落在区间内，需要交给外层
+	 */
+	bool TryPrint(const block_t& block, size_t first, size_t last, TextEdit& edit)
+	{
+		const auto& stats    = *block.stats;
+		auto&       comments = tokenizer_.getCommentTokens();
+		while (true) {
+			// 与前后语句同行时一并选中
+			const Token* previous = PreviousToken(stats[first]);
+			while (first > 0 && previous->line_ == LineOf(Begin(stats[first]->first_token_))) {
+				previous = PreviousToken(stats[--first]);
+			}
+			const Token* last_token = LastToken(block, last);
+			while (last + 1 < stats.size() &&
+				   LineOf(Begin(stats[last + 1]->first_token_)) == last_token->line_) {
+				last_token = LastToken(block, ++last);
+			}
+			if (previous && previous->line_ == LineOf(Begin(stats[first]->first_token_))) {
+				return false;
+			}
+			if (last + 1 == stats.size() && block.terminator &&
+				LineOf(Begin(block.terminator)) == last_token->line_) {
+				return false;
+			}
+
+			const size_t previous_line = previous ? previous->line_ : 0;
+			const size_t region_begin  = LineStart(previous_line + 1);
+			const size_t region_end    = LineStart(last_token->line_ + 1);
+
+			// 长注释从前一个 token 所在行开始、跨进区间
+			size_t comment_begin = 0;
+			while (comment_begin < comments.size() && comments[comment_begin].line_ <= previous_line) {
+				++comment_begin;
+			}
+			if (comment_begin < comments.size() &&
+				comments[comment_begin].type_ != CommentTokenType::EmptyLine &&
+				CommentBegin(comments[comment_begin]) < region_begin) {
+				if (first == 0) {
+					return false;
+				}
+				--first;
+				continue;
+			}
+
+			std::string                         output;
+			AstPrinter<print_mode, std::string> printer(output, &comments);
+			const size_t                        printed =
+				printer.PrintStatements(stats, first, last + 1, block.depth, previous_line);
+
+			// 区间内的注释必须恰好全部打印出来
+			size_t comment_end = comment_begin;
+			while (comment_end < comments.size() &&
+				   (comments[comment_end].type_ == CommentTokenType::EmptyLine
+						? comments[comment_end].line_ <= last_token->line_
+						: CommentBegin(comments[comment_end]) < region_end)) {
+				++comment_end;
+			}
+			if (printed != comment_end) {
+				if (last + 1 == stats.size()) {
+					return false;
+				}
+				++last;
+				continue;
+			}
+
+			edit = TextEdit{region_begin, region_end - region_begin, std::move(output)};
+			return true;
+		}
+	}
+
+	size_t CommentBegin(const CommentToken& comment) const noexcept
+	{
+		return static_cast<size_t>(comment.source_.data() - tokenizer_.getText().data());
+	}
+
+	Tokenizer<tokenize_mode> tokenizer_;
+	Parser                   parser_;
+	const Token*             first_token_;
+	const Token*             last_token_;
+	std::vector<size_t>      line_starts_;
+};
+}   // namespace
+
+TextEdit Formatter::FormatRange(std::string_view input, size_t begin, size_t end,
+								const FormatOptions& options)
+{
+	switch (options.mode) {
+	case FormatMode::Manual:
+		return RangeFormatter<TokenizeMode::FormatManual, AstPrintMode::Manual>(std::string(input),
+																				options.name)
+			.Format(begin, end);
+	case FormatMode::Auto:
+		return RangeFormatter<TokenizeMode::FormatAuto, AstPrintMode::Auto>(std::string(input),
+																			options.name)
+			.Format(begin, end);
+	default: throw std::invalid_argument("Range formatting is not supported in compress mode");
+	}
+}
+
+void Formatter::FormatBatch(const std::vector<std::string_view>& inputs,
+							const FormatOptions& options, std::vector<BatchResult>& results)
+{
+	results.clear();
+	results.resize(inputs.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(inputs.size()); ++i) {
+		auto& result = results[i];
+		try {
+			Format(inputs[i], options, result.output);
+		}
+		catch (const std::exception& e) {
+			result.output.clear();
+			result.error = e.what();
+		}
+	}
+}
@@ -1,11 +1,11 @@
 #include "dl/parser.h"
 #include "dl/ast.h"
+#include "dl/syntax_error.h"
 #include "dl/token.h"
 #include <cstddef>
 #include <cstdio>
 #include <fmt/format.h>
 #include <magic_enum/magic_enum.hpp>
-#include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -30,6 +30,9 @@ void Parser::step_trust_me() noexcept
 
 Token* Parser::get() noexcept
 {
+	if (reached_eof_) {
+		return &eof_token_;
+	}
 	Token* token = &tokens_[position_];
 	if (position_ < tokens_.size() - 1) {
 		++position_;
@@ -42,18 +45,21 @@ Token* Parser::get() noexcept
 
 Token* Parser::peek(size_t offset) const noexcept
 {
+	if (reached_eof_) {
+		return &eof_token_;
+	}
 	offset += position_;
-	return offset < tokens_.size() ? &tokens_[offset] : &tokens_.back();
+	return offset < tokens_.size() ? &tokens_[offset] : &eof_token_;
 }
 
 Token* Parser::peek() const noexcept
 {
-	return &tokens_[position_];
+	return reached_eof_ ? &eof_token_ : &tokens_[position_];
 }
 
-std::string Parser::get_token_start_position(const Token* token) const noexcept
+void Parser::throw_error(const Token* token, const std::string& message) const
 {
-	return fmt::format("{}:{}:", file_name_, token->line_);
+	throw SyntaxError(file_name_, token->line_, message);
 }
 
 bool Parser::is_block_follow() const noexcept
@@ -76,11 +82,10 @@ Token* Parser::expect(TokenType type)
 	if (token->type_ == type) {
 		return get();
 	}
-	SPDLOG_ERROR("Expected token of type {}, but got {} at {}",
-				 magic_enum::enum_name(type),
-				 magic_enum::enum_name(token->type_),
-				 get_token_start_position(token));
-	throw std::runtime_error("Unexpected token");
+	throw_error(token,
+				fmt::format("Expected token of type {}, but got {}",
+							magic_enum::enum_name(type),
+							magic_enum::enum_name(token->type_)));
 }
 
 void Parser::expect_and_drop(TokenType type)
@@ -90,11 +95,10 @@ void Parser::expect_and_drop(TokenType type)
 		step();
 		return;
 	}
-	SPDLOG_ERROR("Expected token of type {}, but got {} at {}",
-				 magic_enum::enum_name(type),
-				 magic_enum::enum_name(token->type_),
-				 get_token_start_position(token));
-	throw std::runtime_error("Unexpected token");
+	throw_error(token,
+				fmt::format("Expected token of type {}, but got {}",
+							magic_enum::enum_name(type),
+							magic_enum::enum_name(token->type_)));
 }
 
 Token* Parser::expect(TokenType type, const std::string_view value)
@@ -103,13 +107,12 @@ Token* Parser::expect(TokenType type, const std::string_view value)
 	if (token->type_ == type && token->source_ == value) {
 		return get();
 	}
-	SPDLOG_ERROR("Expected token of type {} with value '{}', but got {} with value '{}' at {}",
-				 magic_enum::enum_name(type),
-				 value,
-				 magic_enum::enum_name(token->type_),
-				 token->source_,
-				 get_token_start_position(token));
-	throw std::runtime_error("Unexpected token");
+	throw_error(token,
+				fmt::format("Expected token of type {} with value '{}', but got {} with value '{}'",
+							magic_enum::enum_name(type),
+							value,
+							magic_enum::enum_name(token->type_),
+							token->source_));
 }
 
 void Parser::expect_and_drop(TokenType type, const std::string_view value)
@@ -119,21 +122,18 @@ void Parser::expect_and_drop(TokenType type, const std::string_view value)
 		step();
 		return;
 	}
-	SPDLOG_ERROR("Expected token of type {} with value '{}', but got {} with value '{}' at {}",
-				 magic_enum::enum_name(type),
-				 value,
-				 magic_enum::enum_name(token->type_),
-				 token->source_,
-				 get_token_start_position(token));
-	throw std::runtime_error("Unexpected token");
+	throw_error(token,
+				fmt::format("Expected token of type {} with value '{}', but got {} with value '{}'",
+							magic_enum::enum_name(type),
+							value,
+							magic_enum::enum_name(token->type_),
+							token->source_));
 }
 
 void Parser::error(const std::string_view message)
 {
 	const auto& token = peek();
-	SPDLOG_ERROR(
-		"Error at {} {}, token {}", get_token_start_position(token), message, token->source_);
-	throw std::runtime_error("Parsing error");
+	throw_error(token, fmt::format("{}, token {}", message, token->source_));
 }
 
 void Parser::exprlist(std::vector<AstNode*>& expr_list)
@@ -764,14 +764,48 @@ AstNode* Parser::block()
 }
 
 Parser::Parser(std::vector<Token>& tokens, const std::string& file_name)
+	: Parser(tokens, file_name, own_ast_manager_)
+{}
+
+Parser::Parser(std::vector<Token>& tokens, const std::string& file_name, AstManager& ast_manager)
+	: Parser(tokens, file_name, ast_manager, false)
+{}
+
+Parser::Parser(std::vector<Token>& tokens, const std::string& file_name, AstManager& ast_manager,
+			   bool validate_only)
 	: file_name_(file_name)
 	, position_(0)
 	, tokens_(tokens)
+	, ast_manager_(ast_manager)
 	, reached_eof_(false)
-
+	, eof_token_({}, tokens.empty() ? 1 : tokens.back().line_, TokenType::Eof)
 {
 	if (tokens_.empty()) {
 		reached_eof_ = true;
 	}
-	ast_root_ = block();
+	if (validate_only) {
+		// 与 block() 相同的循环，但不收集语句
+		ast_root_    = nullptr;
+		bool is_last = false;
+		while (!is_last && !is_block_follow()) {
+			(void)statement(is_last);
+			if (peek()->source_ == ";" && peek()->type_ == TokenType::Symbol) {
+				step();
+			}
+			ast_manager_.Reset();
+		}
+	}
+	else {
+		ast_root_ = block();
+	}
+	// 顶层块停在 end / else / until 等处时，后面的 token 不能悄悄丢掉
+	if (!reached_eof_) {
+		error("Unexpected token at top level");
+	}
+}
+
+void Parser::Validate(std::vector<Token>& tokens, const std::string& file_name)
+{
+	AstManager scratch;
+	Parser     parser(tokens, file_name, scratch, true);
 }
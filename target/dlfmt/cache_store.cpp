@@ -0,0 +1,558 @@
+#include "cache_store.h"
+#include "dl/xxhash.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <system_error>
+#include <vector>
+#ifdef _WIN32
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/file.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace {
+constexpr char     SNAPSHOT_MAGIC[4] = {'D', 'L', 'F', 'C'};
+constexpr uint32_t SNAPSHOT_FORMAT   = 1;
+constexpr size_t   HEADER_SIZE       = 32;
+constexpr size_t   RECORD_SIZE       = 32;
+constexpr size_t   RESTART_INTERVAL  = 16;
+constexpr size_t   MAX_KEY_SIZE      = 0xFFFF;
+constexpr char     JOURNAL_MAGIC[4]  = {'D', 'L', 'F', 'J'};
+constexpr uint32_t JOURNAL_FORMAT    = 1;
+constexpr size_t   JOURNAL_HEADER    = 8;
+constexpr uint8_t  JOURNAL_PUT       = 0;
+constexpr uint8_t  JOURNAL_ERASE     = 1;
+// 日志超过该大小，且超过快照的 1/4 时合并
+constexpr size_t COMPACT_MIN_JOURNAL = 64 * 1024;
+
+template<typename T> T load(const char* p) noexcept
+{
+	T v;
+	std::memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+template<typename T> void store(std::string& out, T v)
+{
+	out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+void store_record(std::string& out, const file_cache_t& record)
+{
+	store(out, record.size);
+	store(out, record.mtime_ns);
+	store(out, record.hash);
+	store(out, record.params_hash);
+}
+
+file_cache_t load_record(const char* p) noexcept
+{
+	return {load<uint64_t>(p), load<int64_t>(p + 8), load<uint64_t>(p + 16), load<uint64_t>(p + 24)};
+}
+
+// 日志记录的校验和：记录体 xxhash64 的低 32 位
+uint32_t journal_checksum(const char* body, size_t length) noexcept
+{
+	return static_cast<uint32_t>(dl::xxhash64(body, length));
+}
+
+/**
+ * @brief 解码 offset 处的一条记录，key 传入上一条的路径，返回时为本条的完整路径
+ *
+ * @return false 数据越界或损坏
+ */
+bool decode_entry(const char* entries, size_t size, size_t& offset, std::string& key,
+				  file_cache_t& record)
+{
+	if (offset + 4 > size) {
+		return false;
+	}
+	const uint16_t shared   = load<uint16_t>(entries + offset);
+	const uint16_t unshared = load<uint16_t>(entries + offset + 2);
+	if (shared > key.size() || offset + 4 + unshared + RECORD_SIZE > size) {
+		return false;
+	}
+	key.resize(shared);
+	key.append(entries + offset + 4, unshared);
+	record = load_record(entries + offset + 4 + unshared);
+	offset += 4 + unshared + RECORD_SIZE;
+	return true;
+}
+
+struct SnapshotView
+{
+	const char* entries       = nullptr;
+	size_t      entries_size  = 0;
+	const char* restarts      = nullptr;
+	uint64_t    restart_count = 0;
+	uint64_t    entry_count   = 0;
+};
+
+// 校验快照头部与重启点，失败时返回空视图
+SnapshotView parse_snapshot(const char* data, size_t size)
+{
+	SnapshotView view;
+	if (!data || size < HEADER_SIZE || std::memcmp(data, SNAPSHOT_MAGIC, 4) != 0 ||
+		load<uint32_t>(data + 4) != SNAPSHOT_FORMAT) {
+		return view;
+	}
+	const uint64_t entry_count     = load<uint64_t>(data + 8);
+	const uint64_t restart_count   = load<uint64_t>(data + 16);
+	const uint64_t restarts_offset = load<uint64_t>(data + 24);
+	if (restarts_offset < HEADER_SIZE || restarts_offset > size ||
+		restart_count > (size - restarts_offset) / 8) {
+		return view;
+	}
+	const size_t entries_size = restarts_offset - HEADER_SIZE;
+	for (uint64_t i = 0; i < restart_count; ++i) {
+		const uint64_t offset = load<uint64_t>(data + restarts_offset + i * 8);
+		if (offset + 4 > entries_size || load<uint16_t>(data + HEADER_SIZE + offset) != 0) {
+			return view;
+		}
+	}
+	view.entries       = data + HEADER_SIZE;
+	view.entries_size  = entries_size;
+	view.restarts      = data + restarts_offset;
+	view.restart_count = restart_count;
+	view.entry_count   = entry_count;
+	return view;
+}
+}   // namespace
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(),
+							  GENERIC_READ,
+							  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+							  nullptr,
+							  OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL,
+							  nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return;
+	}
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+	file_    = file;
+	mapping_ = mapping;
+	data_    = static_cast<const char*>(view);
+	size_    = static_cast<size_t>(file_size.QuadPart);
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st{};
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED) {
+			data_ = static_cast<const char*>(view);
+			size_ = static_cast<size_t>(st.st_size);
+		}
+	}
+	close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (data_) {
+		UnmapViewOfFile(data_);
+		CloseHandle(mapping_);
+		CloseHandle(file_);
+	}
+#else
+	if (data_) {
+		munmap(const_cast<char*>(data_), size_);
+	}
+#endif
+}
+
+FileLock::FileLock(const std::string& path, bool exclusive)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(),
+								GENERIC_READ | GENERIC_WRITE,
+								FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+								nullptr,
+								OPEN_ALWAYS,
+								FILE_ATTRIBUTE_NORMAL,
+								nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	OVERLAPPED overlapped{};
+	if (!LockFileEx(handle, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &overlapped)) {
+		CloseHandle(handle);
+		return;
+	}
+	handle_ = handle;
+#else
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0) {
+		return;
+	}
+	if (flock(fd_, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+#endif
+}
+
+FileLock::~FileLock()
+{
+#ifdef _WIN32
+	if (handle_) {
+		OVERLAPPED overlapped{};
+		UnlockFileEx(handle_, 0, 1, 0, &overlapped);
+		CloseHandle(handle_);
+	}
+#else
+	if (fd_ >= 0) {
+		flock(fd_, LOCK_UN);
+		close(fd_);
+	}
+#endif
+}
+
+CacheStore::CacheStore(std::string base_path)
+	: base_path_(std::move(base_path))
+	, journal_path_(base_path_ + ".journal")
+	, lock_path_(base_path_ + ".lock")
+{
+	Load();
+}
+
+CacheStore::~CacheStore() = default;
+
+void CacheStore::Load()
+{
+	Unmap();
+	journal_.clear();
+
+	// 共享锁保证读到的快照与日志是同一代
+	FileLock lock(lock_path_, false);
+	snapshot_               = std::make_unique<MappedFile>(base_path_);
+	const SnapshotView view = parse_snapshot(snapshot_->data(), snapshot_->size());
+	entries_                = view.entries;
+	entries_size_           = view.entries_size;
+	restarts_               = view.restarts;
+	restart_count_          = view.restart_count;
+	journal_size_           = ReplayJournal(journal_path_, journal_);
+}
+
+void CacheStore::Unmap()
+{
+	snapshot_.reset();
+	entries_       = nullptr;
+	entries_size_  = 0;
+	restarts_      = nullptr;
+	restart_count_ = 0;
+}
+
+std::optional<file_cache_t> CacheStore::Find(const std::string& path) const
+{
+	if (const auto it = pending_.find(path); it != pending_.end()) {
+		return it->second;
+	}
+	if (const auto it = journal_.find(path); it != journal_.end()) {
+		return it->second;
+	}
+	return FindInSnapshot(path);
+}
+
+std::optional<file_cache_t> CacheStore::FindInSnapshot(std::string_view path) const
+{
+	if (restart_count_ == 0) {
+		return std::nullopt;
+	}
+	// 重启点上的路径是完整的，先二分找到最后一个不大于 path 的重启点
+	const auto restart_key = [this](uint64_t i) {
+		const uint64_t offset = load<uint64_t>(restarts_ + i * 8);
+		const uint16_t length = load<uint16_t>(entries_ + offset + 2);
+		return std::string_view(entries_ + offset + 4,
+								std::min<size_t>(length, entries_size_ - offset - 4));
+	};
+	uint64_t lo = 0;
+	uint64_t hi = restart_count_;
+	while (hi - lo > 1) {
+		const uint64_t mid = lo + (hi - lo) / 2;
+		if (restart_key(mid) <= path) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	// 再顺序扫描这一段
+	size_t       offset = load<uint64_t>(restarts_ + lo * 8);
+	std::string  key;
+	file_cache_t record;
+	for (size_t i = 0; i < RESTART_INTERVAL; ++i) {
+		if (!decode_entry(entries_, entries_size_, offset, key, record)) {
+			break;
+		}
+		const int cmp = std::string_view(key).compare(path);
+		if (cmp == 0) {
+			return record;
+		}
+		if (cmp > 0) {
+			break;
+		}
+	}
+	return std::nullopt;
+}
+
+void CacheStore::Put(const std::string& path, const file_cache_t& record)
+{
+	pending_[path] = record;
+}
+
+void CacheStore::Erase(const std::string& path)
+{
+	if (Find(path)) {
+		pending_[path] = std::nullopt;
+	}
+}
+
+size_t CacheStore::ReplayJournal(const std::string&                                          path,
+								 std::unordered_map<std::string, std::optional<file_cache_t>>& out)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		return 0;
+	}
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	// 头部不对（旧格式或损坏）时整个日志作废，下次追加前会被清空
+	if (data.size() < JOURNAL_HEADER || std::memcmp(data.data(), JOURNAL_MAGIC, 4) != 0 ||
+		load<uint32_t>(data.data() + 4) != JOURNAL_FORMAT) {
+		return 0;
+	}
+
+	// 记录格式：u32 长度 | u32 校验和 | u8 操作 | u16 路径长度 | 路径 | 记录（仅 put）
+	size_t offset = JOURNAL_HEADER;
+	while (offset + 8 <= data.size()) {
+		const uint32_t length = load<uint32_t>(data.data() + offset);
+		const size_t   body   = offset + 8;
+		// 被中断的追加会留下不完整或损坏的尾巴，停在最后一条完整的记录之后
+		if (length < 3 || body + length > data.size() ||
+			load<uint32_t>(data.data() + offset + 4) != journal_checksum(data.data() + body, length)) {
+			break;
+		}
+		const uint8_t  op       = static_cast<uint8_t>(data[body]);
+		const uint16_t path_len = load<uint16_t>(data.data() + body + 1);
+		if (3u + path_len > length) {
+			break;
+		}
+		std::string key(data.data() + body + 3, path_len);
+		if (op == JOURNAL_PUT && length == 3u + path_len + RECORD_SIZE) {
+			out[std::move(key)] = load_record(data.data() + body + 3 + path_len);
+		}
+		else if (op == JOURNAL_ERASE) {
+			out[std::move(key)] = std::nullopt;
+		}
+		offset = body + length;
+	}
+	return offset;
+}
+
+void CacheStore::ReadSnapshot(const char* data, size_t size,
+							  std::map<std::string, file_cache_t>& out)
+{
+	const SnapshotView view = parse_snapshot(data, size);
+	size_t             offset = 0;
+	std::string        key;
+	file_cache_t       record;
+	for (uint64_t i = 0; i < view.entry_count; ++i) {
+		if (!decode_entry(view.entries, view.entries_size, offset, key, record)) {
+			break;
+		}
+		out.emplace(key, record);
+	}
+}
+
+std::string CacheStore::BuildSnapshot(const std::map<std::string, file_cache_t>& records)
+{
+	std::string           entries;
+	std::vector<uint64_t> restarts;
+	std::string_view      previous;
+	uint64_t              count = 0;
+	for (const auto& [key, record] : records) {
+		if (key.size() > MAX_KEY_SIZE) {
+			continue;
+		}
+		size_t shared = 0;
+		if (count % RESTART_INTERVAL == 0) {
+			restarts.push_back(entries.size());
+		}
+		else {
+			const size_t limit = std::min(previous.size(), key.size());
+			while (shared < limit && previous[shared] == key[shared]) {
+				++shared;
+			}
+		}
+		store(entries, static_cast<uint16_t>(shared));
+		store(entries, static_cast<uint16_t>(key.size() - shared));
+		entries.append(key, shared, std::string::npos);
+		store_record(entries, record);
+		previous = key;
+		++count;
+	}
+
+	std::string data;
+	data.reserve(HEADER_SIZE + entries.size() + restarts.size() * 8);
+	data.append(SNAPSHOT_MAGIC, 4);
+	store(data, SNAPSHOT_FORMAT);
+	store(data, count);
+	store(data, static_cast<uint64_t>(restarts.size()));
+	store(data, static_cast<uint64_t>(HEADER_SIZE + entries.size()));
+	data += entries;
+	for (const auto restart : restarts) {
+		store(data, restart);
+	}
+	return data;
+}
+
+bool CacheStore::Compact()
+{
+	// 别的进程可能已经合并过，重新读取磁盘上的最新快照与日志
+	std::map<std::string, file_cache_t> records;
+	{
+		MappedFile current(base_path_);
+		ReadSnapshot(current.data(), current.size(), records);
+	}
+	std::unordered_map<std::string, std::optional<file_cache_t>> journal;
+	ReplayJournal(journal_path_, journal);
+	for (auto& [key, record] : journal) {
+		if (record) {
+			records[key] = *record;
+		}
+		else {
+			records.erase(key);
+		}
+	}
+
+	const std::string data     = BuildSnapshot(records);
+	const std::string tmp_path = base_path_ + ".tmp";
+	{
+		std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+		out.write(data.data(), static_cast<std::streamsize>(data.size()));
+		if (!out) {
+			SPDLOG_WARN("Failed to write cache snapshot {}", tmp_path);
+			return false;
+		}
+	}
+
+	// Windows 上被映射的文件无法被替换，先释放自己的映射；别的进程还在映射时放弃本次合并
+	Unmap();
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, base_path_, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	std::ofstream(journal_path_, std::ios::binary | std::ios::trunc);
+	return true;
+}
+
+void CacheStore::Commit()
+{
+	if (pending_.empty()) {
+		return;
+	}
+
+	std::string buffer;
+	for (const auto& [path, record] : pending_) {
+		if (path.size() > MAX_KEY_SIZE) {
+			continue;
+		}
+		const uint32_t length = static_cast<uint32_t>(3 + path.size() + (record ? RECORD_SIZE : 0));
+		store(buffer, length);
+		const size_t checksum_at = buffer.size();
+		store(buffer, uint32_t{0});
+		store(buffer, record ? JOURNAL_PUT : JOURNAL_ERASE);
+		store(buffer, static_cast<uint16_t>(path.size()));
+		buffer += path;
+		if (record) {
+			store_record(buffer, *record);
+		}
+		const uint32_t checksum = journal_checksum(buffer.data() + checksum_at + 4, length);
+		std::memcpy(buffer.data() + checksum_at, &checksum, sizeof(checksum));
+	}
+
+	bool reload = false;
+	{
+		FileLock lock(lock_path_, true);
+		// 别的进程可能在加载后追加过；截掉被中断的追加留下的尾巴，否则之后的记录在重放时都会丢失
+		std::error_code ec;
+		const size_t    valid  = ReplayJournal(journal_path_, journal_);
+		const size_t    actual = std::filesystem::exists(journal_path_, ec)
+									 ? static_cast<size_t>(std::filesystem::file_size(journal_path_, ec))
+									 : 0;
+		if (!ec && actual != valid) {
+			SPDLOG_WARN("Truncating damaged cache journal {} to {} bytes", journal_path_, valid);
+			std::filesystem::resize_file(journal_path_, valid, ec);
+			if (ec) {
+				SPDLOG_WARN("Failed to truncate cache journal {}", journal_path_);
+				return;
+			}
+		}
+		if (valid == 0) {
+			std::string header(JOURNAL_MAGIC, 4);
+			store(header, JOURNAL_FORMAT);
+			buffer.insert(0, header);
+		}
+		{
+			std::ofstream out(journal_path_, std::ios::binary | std::ios::app);
+			out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			if (!out) {
+				SPDLOG_WARN("Failed to append cache journal {}", journal_path_);
+				return;
+			}
+		}
+		for (auto& [path, record] : pending_) {
+			journal_[path] = record;
+		}
+		pending_.clear();
+
+		journal_size_ = static_cast<size_t>(std::filesystem::file_size(journal_path_, ec));
+		const size_t snapshot_size = snapshot_ ? snapshot_->size() : 0;
+		if (!ec && journal_size_ >= COMPACT_MIN_JOURNAL && journal_size_ * 4 >= snapshot_size) {
+			reload = Compact();
+		}
+	}
+	// 合并后重新映射新的快照，便于同一个进程继续使用
+	if (reload) {
+		Load();
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// 缓存记录：上次处理后文件的大小、修改时间（纳秒）与内容哈希，以及 dlfmt 版本与参数的哈希
+struct file_cache_t
+{
+	uint64_t size        = 0;
+	int64_t  mtime_ns    = 0;
+	uint64_t hash        = 0;
+	uint64_t params_hash = 0;
+};
+
+/**
+ * @brief 只读映射一个文件，映射失败或文件为空时 data() 为空
+ *
+ */
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&)            = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const noexcept { return data_; }
+	size_t      size() const noexcept { return size_; }
+
+private:
+	const char* data_ = nullptr;
+	size_t      size_ = 0;
+#ifdef _WIN32
+	void* file_    = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+/**
+ * @brief 进程间的建议性文件锁（flock / LockFileEx），析构时释放
+ *
+ */
+class FileLock
+{
+public:
+	FileLock(const std::string& path, bool exclusive);
+	~FileLock();
+	FileLock(const FileLock&)            = delete;
+	FileLock& operator=(const FileLock&) = delete;
+
+private:
+#ifdef _WIN32
+	void* handle_ = nullptr;
+#else
+	int fd_ = -1;
+#endif
+};
+
+/**
+ * @brief 增量缓存的二进制存储
+ * @details 由三个文件组成：
+ * - `<base>`：快照。按路径排序、前缀压缩的记录表，每 16 条设一个重启点（完整路径），
+ *   查找时只读映射，在重启点上二分后顺序扫描至多 16 条；
+ * - `<base>.journal`：追加写入的更新日志，每次运行只追加本次变化的记录，每条记录带校验和；
+ * - `<base>.lock`：建议性锁。加载时持共享锁，追加与合并时持排他锁，
+ *   因此编辑器与 pre-commit hook 同时运行也不会互相覆盖。
+ * 日志增长到一定规模后，在排他锁下与快照合并成新快照，再清空日志。
+ */
+class CacheStore
+{
+public:
+	explicit CacheStore(std::string base_path);
+	~CacheStore();
+	CacheStore(const CacheStore&)            = delete;
+	CacheStore& operator=(const CacheStore&) = delete;
+
+	std::optional<file_cache_t> Find(const std::string& path) const;
+
+	/**
+	 * @brief 记录一条更新，Commit 时才写入日志
+	 *
+	 */
+	void Put(const std::string& path, const file_cache_t& record);
+	void Erase(const std::string& path);
+
+	/**
+	 * @brief 把本次的更新追加到日志，日志过大时合并进快照
+	 *
+	 */
+	void Commit();
+
+private:
+	void                        Load();
+	void                        Unmap();
+	std::optional<file_cache_t> FindInSnapshot(std::string_view path) const;
+
+	// 解析日志，后写入的记录覆盖先写入的，nullopt 表示删除。
+	// 返回最后一条完整且校验通过的记录之后的偏移，头部无效时返回 0
+	static size_t ReplayJournal(const std::string&                                          path,
+								std::unordered_map<std::string, std::optional<file_cache_t>>& out);
+	static void ReadSnapshot(const char* data, size_t size,
+							 std::map<std::string, file_cache_t>& out);
+	static std::string BuildSnapshot(const std::map<std::string, file_cache_t>& records);
+
+	// 须在持有排他锁时调用，成功返回 true
+	bool Compact();
+
+	std::string base_path_;
+	std::string journal_path_;
+	std::string lock_path_;
+
+	std::unique_ptr<MappedFile> snapshot_;
+	const char*                 entries_       = nullptr;
+	size_t                      entries_size_  = 0;
+	const char*                 restarts_      = nullptr;
+	uint64_t                    restart_count_ = 0;
+	size_t                      journal_size_  = 0;
+
+	// 已经在日志里的记录
+	std::unordered_map<std::string, std::optional<file_cache_t>> journal_;
+	// 本次运行尚未提交的记录
+	std::unordered_map<std::string, std::optional<file_cache_t>> pending_;
+};
@@ -1,16 +1,45 @@
 #include "dlfmt_core.h"
+#include "cache_store.h"
 #include "dl/ast_printer.h"
+#include "dl/formatter.h"
 #include "dl/parser.h"
 #include "dl/tokenizer.h"
+#include "dl/version.h"
+#include "dl/xxhash.h"
+#include "file_watcher.h"
+#include "git_changes.h"
+#include "line_diff.h"
+#include "memory_budget.h"
+#include "result_cache.h"
+#include "run_stats.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string_view>
 #include <system_error>
 #include <unordered_map>
 #include <vector>
-static constexpr const char* VERSION = "0.1.2";
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#else
+#	include <fcntl.h>
+#	include <sys/resource.h>
+#	include <unistd.h>
+#	ifdef __linux__
+#		include <linux/fs.h>
+#		include <sys/ioctl.h>
+#	endif
+#endif
 using namespace dl;
 void ShowHelp()
 {
@@ -23,8 +52,54 @@ Options:
   --compress-file <file>     Compress the specified file
   --compress-directory <dir> Compress all files in the specified directory recursively
   --json-task <file>         Process tasks defined in the specified JSON file
+  --files-from <file>        Process the files listed in the file ('-' for stdin), one per
+                             line or NUL-separated; prefix an entry with format: or
+                             compress: to choose the action (default: format)
+  --watch <dir|json>         Format the directory, or run the JSON task, then keep running
+                             and reprocess the .lua files that change (Linux only)
+  --check-syntax <path>      Only check that the file, or all files in the directory, parse;
+                             print every error as file:line and exit with 1 if there are any
+  --server                   Stay resident and serve format/compress requests over stdin/stdout
+  --lsp                      Run as a Language Server Protocol server over stdin/stdout
+  --stdin                    Read the source from stdin instead of the file and write the
+                             result to stdout; the file name, if given, is used in messages
+  --stdout                   Write the result of --format-file/--compress-file to stdout
+                             instead of rewriting the file ('-' as the file implies --stdin)
+  --check                    With --format-file, --format-directory, --json-task or
+                             --files-from, write nothing; list the files that would change
+                             as path:line (first differing line), exiting with 1 if there
+                             are any
+  --diff                     Like --check, but print a unified diff of the changes instead
+                             of the file list; exits with 0 unless combined with --check
+  --changed-since <rev>      With --format-directory, --compress-directory or --json-task,
+                             only process the .lua files that differ from the git revision
+                             <rev> (staged or not); alone, formats those under the current
+                             directory
+  --range <start:end>        With --format-file, reprint only the statements covering lines
+                             start..end (1-based, inclusive), or bytes [start, end) as 100b:200b
   --param <parameter>        Specify additional parameters for formatting/compressing
                              Available parameters for format: auto, manual
+  --verify                   Before writing a file, check that the output keeps every input
+                             token and comment in order; files that differ are reported
+                             and left unwritten
+  --output-dir <dir>         With --format-directory or --compress-directory, write the
+                             results to the same relative paths under <dir> and leave the
+                             sources untouched; unchanged outputs are skipped
+  --link-dest <dir>          With --output-dir, hard-link (or reflink, or copy) outputs that
+                             are still up to date from a previous output directory
+  --depfile <file>           With --json-task and --stamp, write a Makefile-style depfile
+                             listing the task file and every input directory and file
+  --stamp <file>             With --json-task, touch <file> when every file succeeded
+  --stats[=json]             Report time per phase (read, tokenize, parse, print, verify,
+                             write), throughput, file latency percentiles and the slowest
+                             files; =json writes the report, with every file, to stdout
+  --shard <i/N>              Split the files of a directory, JSON task or file list into N
+                             shards by relative path and process only shard i (1-based)
+  --max-memory <size>        Limit the memory predicted for files processed concurrently
+                             e.g. 512M, 2G; files larger than the budget run one at a time
+  --result-cache <dir>       Share formatting results by content across worktrees
+                             (default: $DLFMT_CACHE_DIR, disabled when unset)
+  --result-cache-size <size> Size cap of the result cache, e.g. 512M (default: 1G)
   still mysterious? find more in https://crazyspotteddove.github.io/projects/dlfmt
 )");
 }
@@ -34,13 +109,13 @@ void ShowVersion()
 	printf("dlfmt version %s\n", VERSION);
 }
 
-void FormatFile(const std::string& format_file, dlfmt_param param)
+static std::string ReadFile(const std::string& path)
 {
-
-	std::ifstream file(format_file, std::ios::binary);
+	RunStats::PhaseClock clock;
+	std::ifstream        file(path, std::ios::binary);
 	if (!file) {
-		SPDLOG_ERROR("Failed to open file: {}", format_file.c_str());
-		throw std::runtime_error("Failed to open file: " + format_file);
+		SPDLOG_ERROR("Failed to open file: {}", path.c_str());
+		throw std::runtime_error("Failed to open file: " + path);
 	}
 
 	file.seekg(0, std::ios::end);
@@ -51,75 +126,740 @@ void FormatFile(const std::string& format_file, dlfmt_param param)
 		content.resize(size);
 		file.read(&content[0], static_cast<std::streamsize>(size));
 	}
-	file.close();
+	clock.Lap(stats_phase::read);
+	RunStats::AddInput(content.size());
+	return content;
+}
 
-	switch (param) {
-	case dlfmt_param::manual_format:
+// 按块读完标准输入；Windows 下切到二进制模式，保留原有的 \r\n
+static std::string ReadStdin()
+{
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+#endif
+	std::string content;
+	size_t      size = 0;
+	content.resize(64 * 1024);
+	while (true) {
+		size += std::fread(&content[size], 1, content.size() - size, stdin);
+		if (size < content.size()) {
+			break;
+		}
+		content.resize(content.size() * 2);
+	}
+	if (std::ferror(stdin)) {
+		SPDLOG_ERROR("Failed to read stdin");
+		throw std::runtime_error("Failed to read stdin");
+	}
+	content.resize(size);
+	return content;
+}
+
+std::string ReadSource(const std::string& path)
+{
+	return path == "-" ? ReadStdin() : ReadFile(path);
+}
+
+static void WriteFile(const std::string& path, const std::string& content)
+{
+	RunStats::PhaseClock clock;
 	{
-		// tokenize
-		Tokenizer<TokenizeMode::FormatManual> tokenizer(std::move(content), format_file);
+		std::ofstream out_file(path, std::ios::binary | std::ios::trunc);
+		if (!out_file) {
+			SPDLOG_ERROR("Failed to write file: {}", path.c_str());
+			throw std::runtime_error("Failed to write file: " + path);
+		}
+		out_file.write(content.data(), static_cast<std::streamsize>(content.size()));
+	}
+	clock.Lap(stats_phase::write);
+}
+
+// 结果缓存的 salt：dlfmt 版本与打印模式，手动/自动格式化与压缩的结果互不可见
+template<AstPrintMode print_mode> static const std::string& ResultCacheSalt()
+{
+	static const std::string salt =
+		std::string(VERSION) + "|print_mode:" + std::to_string(static_cast<int>(print_mode));
+	return salt;
+}
+
+static bool IsSymbol(const std::vector<Token>& tokens, size_t i, char symbol) noexcept
+{
+	return i < tokens.size() && tokens[i].source_.size() == 1 && tokens[i].source_[0] == symbol &&
+		   tokens[i].type_ == TokenType::Symbol;
+}
+
+static bool IsOptionalToken(const std::vector<Token>& tokens, size_t i) noexcept
+{
+	if (IsSymbol(tokens, i, ',')) {
+		return IsSymbol(tokens, i + 1, '}');
+	}
+	return IsSymbol(tokens, i, ';') && !IsSymbol(tokens, i + 1, '(');
+}
+
+static bool IsWordByte(unsigned char c) noexcept
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+		   c >= 0x80;
+}
+
+/**
+ * @brief previous 与以 first 开头的 token 紧挨着时，分词器是否可能把它们读成别的 token（保守判断）
+ * @details 标识符与数字连写、`--` 注释、以 `.` 结尾的数字与数字、`[[` / `[=` 长括号，
+ * 以及 `==`、`<=`、`//`、`::`、`<<` 等双字符符号。`..` 与 `...` 之后紧跟数字不会粘连
+ */
+static bool MayMerge(std::string_view previous, char first) noexcept
+{
+	const auto l = static_cast<unsigned char>(previous.back());
+	const auto f = static_cast<unsigned char>(first);
+	if (IsWordByte(l) && IsWordByte(f)) {
+		return true;
+	}
+	if ((l == 'e' || l == 'E' || l == 'p' || l == 'P') && (f == '+' || f == '-')) {
+		return true;
+	}
+	if (l == '.' && (f == '.' || (f >= '0' && f <= '9' && previous != ".." && previous != "..."))) {
+		return true;
+	}
+	if (f == '.' && l >= '0' && l <= '9') {
+		return true;
+	}
+	if (l == '[' && (f == '[' || f == '=')) {
+		return true;
+	}
+	if (f == '=' && (l == '=' || l == '<' || l == '>' || l == '~' || l == '/')) {
+		return true;
+	}
+	return l == f && (l == '-' || l == '/' || l == ':' || l == '<' || l == '>');
+}
+
+/**
+ * @brief 校验打印结果与原文的 token 序列一致，不一致时抛出异常
+ * @details 不重新完整分词，而是按原文的 token 表扫描打印结果：跳过空白（格式化模式还要按顺序对上
+ * 每条注释），再与下一个 token 的原文 memcmp。只有打印器把原文中分开的两个 token 连写时，才需要用
+ * MayMerge 判断分词器会不会把它们读成别的 token。可省略的 token 见 IsOptionalToken，
+ * 表构造中作分隔符的 `;` 会被打印成 `,`。调用方在写回之前调用，校验失败的文件保持原样
+ */
+[[noreturn]] static void ThrowVerifyFailed(const Token& token)
+{
+	throw std::runtime_error(fmt::format(
+		"Verification failed, output changes the token '{}' at line {}", token.source_, token.line_));
+}
+
+template<TokenizeMode tokenize_mode>
+static void VerifyOutput(const std::vector<Token>&        tokens,
+						 const std::vector<CommentToken>& comment_tokens, const std::string& output)
+{
+	const char* const begin   = output.data();
+	const char* const end     = begin + output.size();
+	const char*       p       = begin;
+	size_t            comment = 0;
+	// 跳过空白与注释，短注释之后必须换行，否则后面的代码会被注释掉
+	auto skip_gap = [&]() -> bool {
+		while (p != end) {
+			const char c = *p;
+			if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+				++p;
+				continue;
+			}
+			if constexpr (tokenize_mode != TokenizeMode::Compress) {
+				if (c != '-') {
+					break;
+				}
+				while (comment < comment_tokens.size() &&
+					   comment_tokens[comment].type_ == CommentTokenType::EmptyLine) {
+					++comment;
+				}
+				if (comment < comment_tokens.size()) {
+					const auto& source = comment_tokens[comment].source_;
+					if (static_cast<size_t>(end - p) >= source.size() &&
+						std::memcmp(p, source.data(), source.size()) == 0) {
+						p += source.size();
+						if (comment_tokens[comment].type_ == CommentTokenType::ShortComment &&
+							p != end && *p != '\n' && *p != '\r') {
+							return false;
+						}
+						++comment;
+						continue;
+					}
+				}
+			}
+			break;
+		}
+		return true;
+	};
+
+	const Token* previous = nullptr;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		const Token& token = tokens[i];
+		if (token.type_ == TokenType::Symbol && IsOptionalToken(tokens, i)) {
+			if (token.source_[0] == ';') {
+				if (!skip_gap()) {
+					ThrowVerifyFailed(token);
+				}
+				if (p != end && *p == ',') {
+					++p;
+					previous = nullptr;
+				}
+			}
+			continue;
+		}
+		const char* const gap_start = p;
+		if (!skip_gap()) {
+			ThrowVerifyFailed(token);
+		}
+		const size_t size = token.source_.size();
+		if (static_cast<size_t>(end - p) < size ||
+			std::string_view(p, size) != token.source_) {
+			ThrowVerifyFailed(token);
+		}
+		if (p == gap_start && previous &&
+			previous->source_.data() + previous->source_.size() != token.source_.data() &&
+			MayMerge(previous->source_, token.source_.front())) {
+			ThrowVerifyFailed(token);
+		}
+		p += size;
+		previous = &token;
+	}
+	if (!skip_gap() || p != end) {
+		throw std::runtime_error(fmt::format(
+			"Verification failed, output has extra content at byte {}", p - begin));
+	}
+	if constexpr (tokenize_mode != TokenizeMode::Compress) {
+		while (comment < comment_tokens.size() &&
+			   comment_tokens[comment].type_ == CommentTokenType::EmptyLine) {
+			++comment;
+		}
+		if (comment != comment_tokens.size()) {
+			throw std::runtime_error(
+				fmt::format("Verification failed, output drops the comment at line {}",
+							comment_tokens[comment].line_));
+		}
+	}
+}
+
+/**
+ * @brief 分词、解析 path 的内容，打印到内存后整体写出
+ * @details 有结果缓存时先按内容查缓存，命中则跳过分词、解析与打印。
+ * verify 时写出之前先用 VerifyOutput 校验打印结果，缓存命中的结果也一样。
+ * output_file 为空时写回 path，内容没有变化时不写；否则总是写到 output_file
+ *
+ */
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+static dlfmt_file_result ProcessSource(std::string&& content, const std::string& path,
+									   const std::string& output_file, ResultCache* result_cache,
+									   bool verify)
+{
+	const size_t       input_size = content.size();
+	const bool         in_place   = output_file.empty();
+	const std::string& write_path = in_place ? path : output_file;
+
+	dlfmt_file_result result;
+	uint64_t          cache_key = 0;
+	if (result_cache) {
+		cache_key = ResultCache::Key(content, ResultCacheSalt<print_mode>());
+		std::string cached;
+		switch (result_cache->Lookup(cache_key, content, cached)) {
+		case ResultCache::lookup_result::identity:
+			RunStats::AddOutput(input_size);
+			if (!in_place) {
+				WriteFile(write_path, content);
+			}
+			result.footprint   = content.capacity();
+			result.output_size = input_size;
+			result.output_hash = xxhash64(content);
+			return result;
+		case ResultCache::lookup_result::hit:
+			RunStats::AddOutput(cached.size());
+			result.footprint = content.capacity() + cached.capacity();
+			if (verify) {
+				RunStats::PhaseClock     clock;
+				Tokenizer<tokenize_mode> original(std::move(content), path);
+				VerifyOutput<tokenize_mode>(
+					original.getTokens(), original.getCommentTokens(), cached);
+				clock.Lap(stats_phase::verify);
+			}
+			WriteFile(write_path, cached);
+			result.output_size = cached.size();
+			result.output_hash = xxhash64(cached);
+			return result;
+		default: break;
+		}
+	}
+
+	// tokenize
+	RunStats::PhaseClock     clock;
+	Tokenizer<tokenize_mode> tokenizer(std::move(content), path);
+	clock.Lap(stats_phase::tokenize);
 
 #ifndef NDEBUG
+	if constexpr (tokenize_mode == TokenizeMode::FormatManual) {
 		tokenizer.Print();
+	}
 #endif
 
-		// parse
-		Parser parser(tokenizer.getTokens(), format_file);
+	// parse
+	Parser parser(tokenizer.getTokens(), path);
+	clock.Lap(stats_phase::parse);
+	RunStats::AddCounts(tokenizer.getTokens().size(), parser.NodeCount());
 
-		// 打开输出
-		std::ofstream out_file(format_file, std::ios::binary | std::ios::trunc);
+	// 打印到内存
+	std::string output;
+	output.reserve(input_size + input_size / 4);
+	AstPrinter<print_mode, std::string> printer(output, &tokenizer.getCommentTokens());
+	printer.PrintAst(parser.GetAstRoot());
+	clock.Lap(stats_phase::print);
+	RunStats::AddOutput(output.size());
 
-		// 写入
-		AstPrinter<AstPrintMode::Manual> printer(out_file, &tokenizer.getCommentTokens());
-		printer.PrintAst(parser.GetAstRoot());
-		out_file.flush();
-		out_file.close();
-		break;
+	if (verify) {
+		VerifyOutput<tokenize_mode>(tokenizer.getTokens(), tokenizer.getCommentTokens(), output);
+		clock.Lap(stats_phase::verify);
 	}
+	if (result_cache) {
+		result_cache->Store(cache_key, tokenizer.getText(), output);
+	}
+
+	// 写入。写回原文件且内容没有变化时不写，保留文件的 mtime
+	if (!in_place || output != tokenizer.getText()) {
+		WriteFile(write_path, output);
+	}
+
+	result.footprint = tokenizer.MemoryUsage() + parser.MemoryUsage() + sizeof(printer) +
+					   output.capacity();
+	result.output_size = output.size();
+	result.output_hash = xxhash64(output);
+	return result;
+}
+
+static dlfmt_file_result FormatSource(std::string&& content, const std::string& path,
+									  const std::string& output_file, dlfmt_param param,
+									  ResultCache* result_cache, bool verify)
+{
+	switch (param) {
+	case dlfmt_param::manual_format:
+		return ProcessSource<TokenizeMode::FormatManual, AstPrintMode::Manual>(
+			std::move(content), path, output_file, result_cache, verify);
 	default:
-	{
-		// tokenize
-		Tokenizer<TokenizeMode::FormatAuto> tokenizer(std::move(content), format_file);
+		return ProcessSource<TokenizeMode::FormatAuto, AstPrintMode::Auto>(
+			std::move(content), path, output_file, result_cache, verify);
+	}
+}
+
+static dlfmt_file_result CompressSource(std::string&& content, const std::string& path,
+										const std::string& output_file, ResultCache* result_cache,
+										bool verify)
+{
+	return ProcessSource<TokenizeMode::Compress, AstPrintMode::Compress>(
+		std::move(content), path, output_file, result_cache, verify);
+}
+
+dlfmt_file_result FormatFile(const std::string& format_file, dlfmt_param param,
+							 ResultCache* result_cache, bool verify)
+{
+	return FormatSource(ReadFile(format_file), format_file, {}, param, result_cache, verify);
+}
+
+dlfmt_file_result CompressFile(const std::string& compress_file, [[maybe_unused]] dlfmt_param param,
+							   ResultCache* result_cache, bool verify)
+{
+	return CompressSource(ReadFile(compress_file), compress_file, {}, result_cache, verify);
+}
+
+void FormatBuffer(std::string&& content, dlfmt_param param, const std::string& name,
+				  std::string& output)
+{
+	FormatOptions options;
+	options.mode = param == dlfmt_param::manual_format ? FormatMode::Manual : FormatMode::Auto;
+	options.name = name;
+	Formatter::Format(std::move(content), options, output);
+}
+
+void CompressBuffer(std::string&& content, const std::string& name, std::string& output)
+{
+	FormatOptions options;
+	options.mode = FormatMode::Compress;
+	options.name = name;
+	Formatter::Format(std::move(content), options, output);
+}
+
+bool ParseRange(const std::string& text, dlfmt_range& range)
+{
+	const size_t colon = text.find(':');
+	std::string  first = text.substr(0, colon);
+	std::string  last  = colon == std::string::npos ? first : text.substr(colon + 1);
+	const bool   bytes = !first.empty() && first.back() == 'b';
+	if (bytes != (!last.empty() && last.back() == 'b')) {
+		return false;
+	}
+	if (bytes) {
+		first.pop_back();
+		last.pop_back();
+	}
+	// 只接受完整的十进制数字，溢出也算格式错误
+	const auto parse = [](const std::string& digits, size_t& value) {
+		const char* end = digits.data() + digits.size();
+		const auto [ptr, ec] = std::from_chars(digits.data(), end, value);
+		return !digits.empty() && ec == std::errc() && ptr == end;
+	};
+	if (!parse(first, range.begin) || !parse(last, range.end)) {
+		return false;
+	}
+	range.bytes = bytes;
+	// 行号从 1 开始；单个字节偏移表示该位置所在的语句
+	return range.begin <= range.end && (bytes || range.begin > 0);
+}
+
+static TextEdit RangeEdit(const std::string& content, dlfmt_param param, const dlfmt_range& range,
+						  const std::string& name)
+{
+	size_t begin = std::min(range.begin, content.size());
+	size_t end   = std::min(range.end, content.size());
+	if (!range.bytes) {
+		// 第 begin 行的行首到第 end 行的行尾
+		size_t line = 1;
+		begin       = content.size();
+		end         = content.size();
+		for (size_t i = 0; i < content.size(); ++i) {
+			if (line == range.begin && begin == content.size()) {
+				begin = i;
+			}
+			if (content[i] == '\n' && ++line == range.end + 1) {
+				end = i + 1;
+				break;
+			}
+		}
+	}
+	FormatOptions options;
+	options.mode = param == dlfmt_param::manual_format ? FormatMode::Manual : FormatMode::Auto;
+	options.name = name;
+	return Formatter::FormatRange(content, begin, end, options);
+}
+
+void FormatRangeBuffer(std::string&& content, dlfmt_param param, const dlfmt_range& range,
+					   const std::string& name, std::string& output)
+{
+	const TextEdit edit = RangeEdit(content, param, range, name);
+	output              = std::move(content);
+	output.replace(edit.offset, edit.length, edit.text);
+}
+
+void FormatFileRange(const std::string& format_file, dlfmt_param param, const dlfmt_range& range)
+{
+	std::string    content = ReadFile(format_file);
+	const TextEdit edit    = RangeEdit(content, param, range, format_file);
+	if (content.compare(edit.offset, edit.length, edit.text) != 0) {
+		content.replace(edit.offset, edit.length, edit.text);
+		WriteFile(format_file, content);
+	}
+}
+
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+static void ProcessStream(std::string&& content, const std::string& name, std::ostream& out)
+{
+	Tokenizer<tokenize_mode> tokenizer(std::move(content), name);
+	Parser                   parser(tokenizer.getTokens(), name);
+
+	// 解析成功后才开始输出，出错时 out 里不会留下半份结果
+	AstPrinter<print_mode> printer(out, &tokenizer.getCommentTokens());
+	printer.PrintAst(parser.GetAstRoot());
+}
+
+void FormatStream(std::string&& content, dlfmt_param param, const std::string& name,
+				  std::ostream& out)
+{
+	switch (param) {
+	case dlfmt_param::manual_format:
+		ProcessStream<TokenizeMode::FormatManual, AstPrintMode::Manual>(
+			std::move(content), name, out);
+		break;
+	default:
+		ProcessStream<TokenizeMode::FormatAuto, AstPrintMode::Auto>(std::move(content), name, out);
+		break;
+	}
+}
+
+void CompressStream(std::string&& content, const std::string& name, std::ostream& out)
+{
+	ProcessStream<TokenizeMode::Compress, AstPrintMode::Compress>(std::move(content), name, out);
+}
 
-		// parse
-		Parser parser(tokenizer.getTokens(), format_file);
+/**
+ * @brief 一次分词、一次解析，驱动格式化与压缩两个打印器
+ * @details 格式化模式的分词器把注释放在另一张表里，token 流与压缩模式完全一致；压缩打印器不读注释，
+ * 所以两个打印器可以共用同一棵 AST
+ */
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+static dlfmt_fanout_result FanoutFile(const std::string& path, const std::string& compress_path,
+									  bool verify)
+{
+	std::string  content    = ReadFile(path);
+	const size_t input_size = content.size();
 
-		// 打开输出
-		std::ofstream out_file(format_file, std::ios::binary | std::ios::trunc);
+	RunStats::PhaseClock     clock;
+	Tokenizer<tokenize_mode> tokenizer(std::move(content), path);
+	clock.Lap(stats_phase::tokenize);
+	Parser parser(tokenizer.getTokens(), path);
+	clock.Lap(stats_phase::parse);
+	RunStats::AddCounts(tokenizer.getTokens().size(), parser.NodeCount());
 
-		// 写入
-		AstPrinter<AstPrintMode::Auto> printer(out_file, &tokenizer.getCommentTokens());
+	std::string formatted;
+	formatted.reserve(input_size + input_size / 4);
+	{
+		AstPrinter<print_mode, std::string> printer(formatted, &tokenizer.getCommentTokens());
 		printer.PrintAst(parser.GetAstRoot());
-		out_file.flush();
-		out_file.close();
 	}
+	std::string compressed;
+	compressed.reserve(input_size);
+	{
+		AstPrinter<AstPrintMode::Compress, std::string> printer(compressed);
+		printer.PrintAst(parser.GetAstRoot());
+	}
+	clock.Lap(stats_phase::print);
+	RunStats::AddOutput(formatted.size() + compressed.size());
+
+	if (verify) {
+		VerifyOutput<tokenize_mode>(
+			tokenizer.getTokens(), tokenizer.getCommentTokens(), formatted);
+		VerifyOutput<TokenizeMode::Compress>(
+			tokenizer.getTokens(), tokenizer.getCommentTokens(), compressed);
+		clock.Lap(stats_phase::verify);
 	}
+	if (formatted != tokenizer.getText()) {
+		WriteFile(path, formatted);
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(compress_path).parent_path(), ec);
+	WriteFile(compress_path, compressed);
+
+	dlfmt_fanout_result result;
+	result.format.footprint = tokenizer.MemoryUsage() + parser.MemoryUsage() +
+							  sizeof(AstPrinter<print_mode, std::string>) + formatted.capacity() +
+							  compressed.capacity();
+	result.format.output_size   = formatted.size();
+	result.format.output_hash   = xxhash64(formatted);
+	result.compress.footprint   = result.format.footprint;
+	result.compress.output_size = compressed.size();
+	result.compress.output_hash = xxhash64(compressed);
+	return result;
 }
 
-void FormatDirectory(const std::string& format_directory, dlfmt_param param)
+dlfmt_fanout_result FormatAndCompressFile(const std::string& source_file,
+										  const std::string& compress_file, dlfmt_param param,
+										  bool verify)
 {
-	if (format_directory.empty()) {
-		SPDLOG_ERROR("No directory specified for formatting.");
-		throw std::invalid_argument("No directory specified for formatting.");
+	switch (param) {
+	case dlfmt_param::manual_format:
+		return FanoutFile<TokenizeMode::FormatManual, AstPrintMode::Manual>(
+			source_file, compress_file, verify);
+	default:
+		return FanoutFile<TokenizeMode::FormatAuto, AstPrintMode::Auto>(
+			source_file, compress_file, verify);
+	}
+}
+
+std::unique_ptr<ResultCache> OpenResultCache(const dlfmt_options& options)
+{
+	if (options.result_cache_dir.empty()) {
+		return nullptr;
+	}
+	return std::make_unique<ResultCache>(options.result_cache_dir, options.result_cache_size);
+}
+
+static void ReportResultCache(const ResultCache* result_cache)
+{
+	if (result_cache) {
+		SPDLOG_INFO("Result cache {}: {} hits, {} misses.",
+					result_cache->Directory(),
+					result_cache->Hits(),
+					result_cache->Misses());
+	}
+}
+
+static size_t FileSizeOrZero(const std::string& path)
+{
+	std::error_code ec;
+	const auto      size = std::filesystem::file_size(path, ec);
+	return ec ? 0 : static_cast<size_t>(size);
+}
+
+// 进程的峰值常驻内存（字节），拿不到时返回 0
+static size_t PeakResidentSetSize()
+{
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#	ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#	else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#	endif
+#endif
+}
+
+static std::unique_ptr<MemoryBudget> MakeMemoryBudget(const dlfmt_options& options)
+{
+	if (options.max_memory == 0) {
+		return nullptr;
+	}
+	return std::make_unique<MemoryBudget>(options.max_memory);
+}
+
+static void ReportMemoryBudget(MemoryBudget* budget)
+{
+	if (!budget) {
+		return;
+	}
+	constexpr double MiB = 1024.0 * 1024.0;
+	SPDLOG_INFO("Memory budget {:.1f} MiB: peak reserved {:.1f} MiB, largest file footprint {:.1f} "
+				"MiB, expansion factor {:.1f}.",
+				budget->Limit() / MiB,
+				budget->PeakInUse() / MiB,
+				budget->PeakFootprint() / MiB,
+				budget->ExpansionFactor());
+	if (const size_t rss = PeakResidentSetSize()) {
+		SPDLOG_INFO("Peak resident memory {:.1f} MiB.", rss / MiB);
+	}
+}
+
+/**
+ * @brief 分片用的路径键：path 相对 base 的 / 分隔写法
+ * @details 两者先补成绝对路径再规范化，./src 与 src、/ 与 \、不同 checkout 根目录下同一棵树的结果都一致
+ */
+static std::string ShardKey(const std::string& path, const std::string& base)
+{
+	std::error_code             ec;
+	const std::filesystem::path absolute_path = std::filesystem::absolute(path, ec).lexically_normal();
+	const std::filesystem::path absolute_base = std::filesystem::absolute(base, ec).lexically_normal();
+	std::filesystem::path       relative      = absolute_path.lexically_relative(absolute_base);
+	if (relative.empty()) {
+		relative = absolute_path;
+	}
+	return relative.generic_string();
+}
+
+/**
+ * @brief --shard：把文件确定性地分到若干分片，只保留属于本分片的
+ * @details 各分片看到同样的文件清单时得到同样的划分，不需要互相通信。path_of 取各项的路径，
+ * key_of(i) 返回第 i 项相对
+ * 收集根目录（目录、任务目录或当前目录）的路径，文件按它的哈希排序后轮流发给各分片，
+ * 各分片的文件数至多差 1。划分只取决于相对路径，不看文件大小：换行符不同（autocrlf）或
+ * checkout 的根目录不同时，同一棵树也分得一样。大小只用于日志
+ */
+template<typename T, typename PathOf, typename KeyOf>
+static void SelectShard(std::vector<T>& items, const dlfmt_options& options, PathOf&& path_of,
+						KeyOf&& key_of)
+{
+	if (options.shard_count <= 1) {
+		return;
+	}
+	struct shard_entry_t
+	{
+		uint64_t    hash = 0;
+		std::string key;
+		size_t      index = 0;
+	};
+	std::vector<shard_entry_t> entries(items.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(items.size()); ++i) {
+		auto& entry = entries[i];
+		entry.key   = key_of(static_cast<size_t>(i));
+		entry.hash  = xxhash64(entry.key);
+		entry.index = static_cast<size_t>(i);
+	}
+	std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+		if (a.hash != b.hash) {
+			return a.hash < b.hash;
+		}
+		return a.key < b.key;
+	});
+
+	std::vector<char> keep(items.size(), 0);
+	for (size_t i = options.shard_index; i < entries.size(); i += options.shard_count) {
+		keep[entries[i].index] = 1;
 	}
 
-	// 收集所有 .lua 文件
+	std::vector<T> selected;
+	uint64_t       total_bytes = 0;
+	uint64_t       shard_bytes = 0;
+	for (size_t i = 0; i < items.size(); ++i) {
+		const uint64_t size = FileSizeOrZero(path_of(items[i]));
+		total_bytes += size;
+		if (keep[i]) {
+			shard_bytes += size;
+			selected.push_back(std::move(items[i]));
+		}
+	}
+	constexpr double MiB = 1024.0 * 1024.0;
+	SPDLOG_INFO("Shard {}/{}: {} of {} files, {:.1f} of {:.1f} MiB.",
+				options.shard_index + 1,
+				options.shard_count,
+				selected.size(),
+				items.size(),
+				shard_bytes / MiB,
+				total_bytes / MiB);
+	items = std::move(selected);
+}
+
+// 递归收集目录下所有 .lua 文件；有 --changed-since 的改动列表时只取列表中位于目录下的文件，
+// 有 --shard 时只留本分片的文件
+static std::vector<std::string> CollectLuaFiles(const std::string&   directory,
+												const dlfmt_options& options)
+{
 	std::vector<std::string> files;
-	for (const auto& entry : std::filesystem::recursive_directory_iterator(format_directory)) {
-		if (entry.is_regular_file()) {
-			const auto& path = entry.path();
-			if (path.has_extension() && path.extension() == ".lua") {
-				files.emplace_back(path.string());
+	if (options.changed_files) {
+		files = ChangedFilesUnder(directory, *options.changed_files);
+		SPDLOG_INFO("{} changed .lua files collected.", files.size());
+	}
+	else {
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+			if (entry.is_regular_file()) {
+				const auto& path = entry.path();
+				if (path.has_extension() && path.extension() == ".lua") {
+					files.emplace_back(path.string());
+				}
 			}
 		}
+		SPDLOG_INFO("{} .lua files collected.", files.size());
+	}
+	SelectShard(
+		files,
+		options,
+		[](const std::string& path) -> const std::string& { return path; },
+		[&](size_t i) { return ShardKey(files[i], directory); });
+	return files;
+}
+
+static void ProcessToOutputDir(const std::string& directory, bool compress, dlfmt_param param,
+							   const dlfmt_options& options);
+
+void FormatDirectory(const std::string& format_directory, dlfmt_param param,
+					 const dlfmt_options& options)
+{
+	if (format_directory.empty()) {
+		SPDLOG_ERROR("No directory specified for formatting.");
+		throw std::invalid_argument("No directory specified for formatting.");
+	}
+	if (!options.output_dir.empty()) {
+		ProcessToOutputDir(format_directory, false, param, options);
+		return;
 	}
-	SPDLOG_INFO("{} .lua files collected.", files.size());
+
+	const std::vector<std::string> files = CollectLuaFiles(format_directory, options);
+
+	const auto budget       = MakeMemoryBudget(options);
+	const auto result_cache = OpenResultCache(options);
 
 // 并行格式化
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < static_cast<int>(files.size()); ++i) {
 		try {
-			FormatFile(files[i], param);
+			RunStats::FileScope  stats_scope(options.stats, files[i]);
+			MemoryBudget::Ticket ticket(budget.get(), FileSizeOrZero(files[i]));
+			ticket.SetFootprint(
+				FormatFile(files[i], param, result_cache.get(), options.verify).footprint);
 		}
 		catch (const std::exception& e) {
 #pragma omp critical
@@ -134,66 +874,35 @@ void FormatDirectory(const std::string& format_directory, dlfmt_param param)
 			}
 		}
 	}
+	ReportMemoryBudget(budget.get());
+	ReportResultCache(result_cache.get());
 }
 
-void CompressFile(const std::string& compress_file, [[maybe_unused]] dlfmt_param param)
-{
-	std::ifstream file(compress_file, std::ios::binary);
-	if (!file) {
-		SPDLOG_ERROR("Failed to open file: {}", compress_file.c_str());
-		throw std::runtime_error("Failed to open file: " + compress_file);
-	}
-
-	file.seekg(0, std::ios::end);
-	const auto size = static_cast<size_t>(file.tellg());
-	file.seekg(0);
-	std::string content;
-	if (size) {
-		content.resize(size);
-		file.read(&content[0], static_cast<std::streamsize>(size));
-	}
-	file.close();
-
-	// tokenize
-	Tokenizer<TokenizeMode::Compress> tokenizer(std::move(content), compress_file);
-
-	// parse
-	Parser parser(tokenizer.getTokens(), compress_file);
-
-	// 打开输出
-	std::ofstream out_file(compress_file, std::ios::binary | std::ios::trunc);
-
-	// 写入
-	AstPrinter<AstPrintMode::Compress> printer(out_file);
-	printer.PrintAst(parser.GetAstRoot());
-	out_file.flush();
-	out_file.close();
-}
-
-void CompressDirectory(const std::string& compress_directory, [[maybe_unused]] dlfmt_param param)
+void CompressDirectory(const std::string& compress_directory, [[maybe_unused]] dlfmt_param param,
+					   const dlfmt_options& options)
 {
 	if (compress_directory.empty()) {
 		SPDLOG_ERROR("No directory specified for formatting.");
 		throw std::invalid_argument("No directory specified for formatting.");
 	}
-
-	// 收集所有 .lua 文件
-	std::vector<std::string> files;
-	for (const auto& entry : std::filesystem::recursive_directory_iterator(compress_directory)) {
-		if (entry.is_regular_file()) {
-			const auto& path = entry.path();
-			if (path.has_extension() && path.extension() == ".lua") {
-				files.emplace_back(path.string());
-			}
-		}
+	if (!options.output_dir.empty()) {
+		ProcessToOutputDir(compress_directory, true, param, options);
+		return;
 	}
-	SPDLOG_INFO("{} .lua files collected.", files.size());
+
+	const std::vector<std::string> files = CollectLuaFiles(compress_directory, options);
+
+	const auto budget       = MakeMemoryBudget(options);
+	const auto result_cache = OpenResultCache(options);
 
 // 并行格式化
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < static_cast<int>(files.size()); ++i) {
 		try {
-			CompressFile(files[i], param);
+			RunStats::FileScope  stats_scope(options.stats, files[i]);
+			MemoryBudget::Ticket ticket(budget.get(), FileSizeOrZero(files[i]));
+			ticket.SetFootprint(
+				CompressFile(files[i], param, result_cache.get(), options.verify).footprint);
 		}
 		catch (const std::exception& e) {
 #pragma omp critical
@@ -208,68 +917,375 @@ void CompressDirectory(const std::string& compress_directory, [[maybe_unused]] d
 			}
 		}
 	}
+	ReportMemoryBudget(budget.get());
+	ReportResultCache(result_cache.get());
 }
 
-using json         = nlohmann::json;
-using file_cache_t = int64_t;
+using json = nlohmann::json;
+
+enum class task_action
+{
+	format,
+	compress,
+	// 格式化原文件，同时把压缩结果写到镜像的输出目录
+	format_compress
+};
+
+static constexpr const char* CACHE_PATH = ".dlfmt_cache";
 
-static int64_t FileTimeTypeToTimeT(std::filesystem::file_time_type t)
+static int64_t FileTimeToNs(std::filesystem::file_time_type t)
 {
 	using namespace std::chrono;
-	auto sctp = time_point_cast<system_clock::duration>(
-		t - std::filesystem::file_time_type::clock::now() + system_clock::now());
-	return duration_cast<seconds>(sctp.time_since_epoch()).count();
+	return duration_cast<nanoseconds>(t.time_since_epoch()).count();
 }
 
-// 只用mtime判断
-static bool ShouldProcessFile(const std::string&                                   path,
-							  const std::unordered_map<std::string, file_cache_t>& file_cache)
+// 同一路径可能先 format 再 compress，所以参数哈希覆盖整条处理链，并带上 dlfmt 版本
+static uint64_t ChainParamsHash(const std::vector<task_action>& chain, dlfmt_param param_format,
+								[[maybe_unused]] dlfmt_param param_compress,
+								const std::string*           compress_output)
 {
-	// std::string     abspath = std::filesystem::absolute(path).string();
-	std::error_code ec;
-	// auto            mtime = std::filesystem::last_write_time(abspath, ec);
-	const auto mtime = std::filesystem::last_write_time(path, ec);
-	if (ec) return true;
-	const int64_t s_mtime = FileTimeTypeToTimeT(mtime);
-	// const auto    it      = file_cache.find(abspath);
-	const auto it = file_cache.find(path);
-	if (it != file_cache.end() && it->second == s_mtime) {
-		return false;
-	}
-	return true;
+	std::string key = VERSION;
+	for (const auto action : chain) {
+		if (action == task_action::format || action == task_action::format_compress) {
+			key += param_format == dlfmt_param::manual_format ? "|format:manual" : "|format:auto";
+		}
+		if (action == task_action::format_compress) {
+			key += "|compress>" + *compress_output;
+		}
+		else if (action == task_action::compress) {
+			// 压缩没有参数，"|compress" 就是完整的键
+			key += "|compress";
+		}
+	}
+	return xxhash64(key);
 }
 
-void JsonTask(const std::string& json_file)
+// 先比较大小和 mtime，mtime 不同时才读入内容比较哈希。
+// 内容没变、只是 mtime 变了（例如 git checkout）时，把刷新了 mtime 的记录放进 refreshed。
+// 只读缓存，可以并发调用
+static bool ShouldProcessFile(const std::string& path, uint64_t params_hash,
+							  const CacheStore& file_cache, std::optional<file_cache_t>& refreshed)
 {
-	// 加载任务缓存记录
-	std::unordered_map<std::string, file_cache_t> file_cache;
-	const std::string                             cache_path = ".dlfmt_cache.json";
-	file_cache.clear();
-	std::ifstream cache_in(cache_path);
-	if (cache_in) {
-		json cache_j;
-		cache_in >> cache_j;
-		for (auto& [k, v] : cache_j.items()) {
-			file_cache[k] = {v.get<file_cache_t>()};
+	auto cached = file_cache.Find(path);
+	if (!cached || cached->params_hash != params_hash) {
+		return true;
+	}
+	std::error_code ec;
+	const auto      size = std::filesystem::file_size(path, ec);
+	if (ec || size != cached->size) {
+		return true;
+	}
+	const auto mtime = std::filesystem::last_write_time(path, ec);
+	if (ec) {
+		return true;
+	}
+	const int64_t mtime_ns = FileTimeToNs(mtime);
+	if (mtime_ns == cached->mtime_ns) {
+		return false;
+	}
+	std::string content;
+	try {
+		content = ReadFile(path);
+	}
+	catch (...) {
+		return true;
+	}
+	if (xxhash64(content) != cached->hash) {
+		return true;
+	}
+	cached->mtime_ns = mtime_ns;
+	refreshed        = cached;
+	return false;
+}
+
+// 输出目录里的记录：键为相对路径，size 与 hash 是输入的大小与内容哈希，mtime_ns 是输出文件的 mtime
+static constexpr const char* OUTPUT_MANIFEST = ".dlfmt_output";
+
+// 输出目录 dir 里相对路径 relative 的输出仍是 record 记下的那一份，并且对应的输入与参数都没有变
+static bool OutputUpToDate(const std::filesystem::path& dir, const std::string& relative,
+						   const CacheStore* manifest, uint64_t input_size, uint64_t input_hash,
+						   uint64_t params_hash)
+{
+	if (!manifest) {
+		return false;
+	}
+	const auto record = manifest->Find(relative);
+	if (!record || record->size != input_size || record->hash != input_hash ||
+		record->params_hash != params_hash) {
+		return false;
+	}
+	std::error_code ec;
+	const auto      mtime = std::filesystem::last_write_time(dir / relative, ec);
+	return !ec && FileTimeToNs(mtime) == record->mtime_ns;
+}
+
+// 把上一代的输出 from 放到 to：先试硬链接，不行（跨文件系统等）时试 reflink，都不行就复制
+static void LinkOrCopyFile(const std::filesystem::path& from, const std::filesystem::path& to)
+{
+	std::error_code ec;
+	std::filesystem::create_hard_link(from, to, ec);
+	if (!ec) {
+		return;
+	}
+#ifdef __linux__
+	const int source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+	if (source >= 0) {
+		const int target = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		const bool cloned = target >= 0 && ioctl(target, FICLONE, source) == 0;
+		if (target >= 0) {
+			close(target);
+		}
+		close(source);
+		if (cloned) {
+			return;
+		}
+	}
+#endif
+	std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+}
+
+// 只读打开输出目录里的记录，不存在时不去创建
+static std::unique_ptr<CacheStore> OpenOutputManifest(const std::filesystem::path& dir)
+{
+	const std::string base = (dir / OUTPUT_MANIFEST).string();
+	std::error_code   ec;
+	if (!std::filesystem::exists(base, ec) && !std::filesystem::exists(base + ".journal", ec)) {
+		return nullptr;
+	}
+	return std::make_unique<CacheStore>(base);
+}
+
+/**
+ * @brief 处理 directory 下的文件，结果写到 options.output_dir 下的同一相对路径，不改动源文件
+ * @details 输出目录里记着每个输出对应的输入哈希与参数：输入没有变、输出也没被改动过的文件直接跳过；
+ * 指定了 options.link_dest（上一代输出目录）时，那里的输出如果仍然对应当前输入，
+ * 就把它硬链接（或 reflink、复制）过来，不再分词、解析与打印。
+ * 写出之前总是先删除旧的输出，避免改写与上一代共享 inode 的硬链接
+ */
+static void ProcessToOutputDir(const std::string& directory, bool compress, dlfmt_param param,
+							   const dlfmt_options& options)
+{
+	const std::vector<std::string> files = CollectLuaFiles(directory, options);
+	const std::filesystem::path    output_dir(options.output_dir);
+	const std::filesystem::path    link_dest(options.link_dest);
+
+	std::vector<std::string> relatives(files.size());
+	std::vector<std::string> outputs(files.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		relatives[i] =
+			std::filesystem::path(files[i]).lexically_relative(directory).generic_string();
+		outputs[i] = (output_dir / relatives[i]).string();
+	}
+
+	// 并行建立镜像目录：只建最深的那些，create_directories 会顺带建出上层
+	std::vector<std::string> parents;
+	parents.reserve(files.size() + 1);
+	parents.push_back(output_dir.string());
+	for (const auto& output : outputs) {
+		parents.push_back(std::filesystem::path(output).parent_path().string());
+	}
+	std::sort(parents.begin(), parents.end());
+	parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+	std::vector<std::exception_ptr> mkdir_errors(parents.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(parents.size()); ++i) {
+		std::error_code ec;
+		std::filesystem::create_directories(parents[i], ec);
+		// 另一个线程可能刚建好同一个上层目录
+		if (ec && !std::filesystem::is_directory(parents[i])) {
+			mkdir_errors[i] = std::make_exception_ptr(
+				std::filesystem::filesystem_error("Failed to create directory", parents[i], ec));
+		}
+	}
+	for (const auto& error : mkdir_errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	CacheStore                        manifest((output_dir / OUTPUT_MANIFEST).string());
+	const std::unique_ptr<CacheStore> previous =
+		options.link_dest.empty() ? nullptr : OpenOutputManifest(link_dest);
+	const uint64_t params_hash = ChainParamsHash(
+		{compress ? task_action::compress : task_action::format}, param, param, nullptr);
+
+	const auto budget       = MakeMemoryBudget(options);
+	const auto result_cache = OpenResultCache(options);
+
+	enum class output_state : char
+	{
+		failed,
+		unchanged,
+		linked,
+		written
+	};
+	std::vector<output_state>                states(files.size(), output_state::failed);
+	std::vector<std::optional<file_cache_t>> records(files.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+		try {
+			RunStats::FileScope  stats_scope(options.stats, files[i]);
+			MemoryBudget::Ticket ticket(budget.get(), FileSizeOrZero(files[i]));
+			std::string          content    = ReadFile(files[i]);
+			const uint64_t       input_size = content.size();
+			const uint64_t       input_hash = xxhash64(content);
+			if (OutputUpToDate(
+					output_dir, relatives[i], &manifest, input_size, input_hash, params_hash)) {
+				states[i] = output_state::unchanged;
+				continue;
+			}
+
+			std::error_code ec;
+			std::filesystem::remove(outputs[i], ec);
+			if (OutputUpToDate(link_dest,
+							   relatives[i],
+							   previous.get(),
+							   input_size,
+							   input_hash,
+							   params_hash)) {
+				LinkOrCopyFile(link_dest / relatives[i], outputs[i]);
+				states[i] = output_state::linked;
+			}
+			else {
+				const dlfmt_file_result result =
+					compress ? CompressSource(std::move(content),
+											  files[i],
+											  outputs[i],
+											  result_cache.get(),
+											  options.verify)
+							 : FormatSource(std::move(content),
+											files[i],
+											outputs[i],
+											param,
+											result_cache.get(),
+											options.verify);
+				ticket.SetFootprint(result.footprint);
+				states[i] = output_state::written;
+			}
+			const auto mtime = std::filesystem::last_write_time(outputs[i], ec);
+			if (!ec) {
+				records[i] = file_cache_t{input_size, FileTimeToNs(mtime), input_hash, params_hash};
+			}
+		}
+		catch (const std::exception& e) {
+#pragma omp critical
+			{
+				SPDLOG_ERROR("{} failed: {} ({})", compress ? "Compress" : "Format", files[i], e.what());
+			}
+		}
+	}
+	ReportMemoryBudget(budget.get());
+	ReportResultCache(result_cache.get());
+
+	size_t written = 0;
+	size_t linked  = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		switch (states[i]) {
+		case output_state::written: ++written; break;
+		case output_state::linked: ++linked; break;
+		default: break;
+		}
+		if (records[i]) {
+			manifest.Put(relatives[i], *records[i]);
+		}
+		else if (states[i] == output_state::failed) {
+			manifest.Erase(relatives[i]);
+		}
+	}
+	manifest.Commit();
+	SPDLOG_INFO("{} files written to {}, {} linked from the previous output, {} unchanged.",
+				written,
+				options.output_dir,
+				linked,
+				files.size() - written - linked -
+					static_cast<size_t>(
+						std::count(states.begin(), states.end(), output_state::failed)));
+}
+
+// 收集单个任务目录下的 lua 文件，跳过 exclude 中的路径。changed_files 不为空时只从其中挑选；
+// 遍历目录时 directories 不为空则记下遍历到的每个目录（含任务目录本身），供 --depfile 使用
+static std::vector<std::string> CollectTaskFiles(const json&                     task,
+												 const std::vector<std::string>* changed_files,
+												 std::vector<std::string>*       directories)
+{
+	std::vector<std::string> exclude;
+	if (task.contains("exclude")) {
+		for (const auto& ex : task["exclude"]) {
+			exclude.push_back(std::filesystem::path(ex.get<std::string>()).string());
+		}
+	}
+
+	const auto is_excluded = [&exclude](const std::string& path) {
+		for (const auto& ex : exclude) {
+			if (path.compare(0, ex.size(), ex) == 0) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	const std::string        directory = task["directory"].get<std::string>();
+	std::vector<std::string> files;
+	if (changed_files) {
+		for (auto& path : ChangedFilesUnder(directory, *changed_files)) {
+			if (!is_excluded(path)) {
+				files.push_back(std::move(path));
+			}
+		}
+		return files;
+	}
+	if (directories) {
+		directories->push_back(directory);
+	}
+	for (auto it = std::filesystem::recursive_directory_iterator(directory);
+		 it != std::filesystem::recursive_directory_iterator();
+		 ++it) {
+		const auto& entry = *it;
+		if (entry.is_directory()) {
+			std::string path = entry.path().string();
+			// 排除的是路径前缀，目录被排除时其下的文件也都被排除，不必再往下走
+			if (is_excluded(path)) {
+				it.disable_recursion_pending();
+			}
+			else if (directories) {
+				directories->push_back(std::move(path));
+			}
+		}
+		else if (entry.is_regular_file() && entry.path().extension() == ".lua") {
+			std::string path = entry.path().string();
+			// 文件路径被排除，不加入任务清单
+			if (is_excluded(path)) {
+				continue;
+			}
+			files.push_back(std::move(path));
 		}
-		cache_in.close();
 	}
+	return files;
+}
+
+struct json_task_t
+{
+	json        tasks;
+	dlfmt_param param_format   = dlfmt_param::auto_format;
+	dlfmt_param param_compress = dlfmt_param::auto_format;
+};
 
-	// 解析 dlua_task.json
+// 解析 dlua_task.json
+static json_task_t LoadJsonTask(const std::string& json_file)
+{
 	std::ifstream task_in(json_file);
 	if (!task_in) throw std::runtime_error("Failed to open json task file");
 	json task_j;
 	task_in >> task_j;
 	task_in.close();
 
-	dlfmt_param param_format   = dlfmt_param::auto_format;
-	dlfmt_param param_compress = dlfmt_param::auto_format;
+	json_task_t result;
 	if (task_j.contains("params")) {
 		auto params = task_j["params"];
 		if (params.contains("format")) {
 			std::string fmt_param = params["format"];
 			if (fmt_param == "manual") {
-				param_format = dlfmt_param::manual_format;
+				result.param_format = dlfmt_param::manual_format;
 			}
 		}
 
@@ -278,137 +1294,784 @@ void JsonTask(const std::string& json_file)
 			// TODO: no param available for compress now
 		}
 	}
+	result.tasks = task_j["tasks"];
+	return result;
+}
 
-	auto tasks = task_j["tasks"];
-
-	std::vector<std::string> format_tasks;
-	std::vector<std::string> compress_tasks;
-
-	std::filesystem::path work_dir = std::filesystem::current_path();
-
-	// 直接先收集任务
-	for (const auto& task : tasks) {
-		if (task["type"] == "compress") {
-			std::vector<std::filesystem::path> exclude;
-			if (task.contains("exclude")) {
-				for (const auto& ex : task["exclude"])
-					// exclude.push_back(std::filesystem::absolute(work_dir /
-					// ex.get<std::string>()));
-					exclude.push_back(std::filesystem::path(ex.get<std::string>()));
-			}
-			// 遍历目录，收集所有lua文件
-			for (const auto& entry :
-				 std::filesystem::recursive_directory_iterator(task["directory"])) {
-				if (entry.is_regular_file() && entry.path().extension() == ".lua") {
-					// std::string abs_path =
-					// std::filesystem::absolute(entry.path().string()).string();
-					std::string path = entry.path().string();
-					// 文件没有变，不需要加入任务清单
-					// if (!ShouldProcessFile(abs_path, file_cache)) {
-					// continue;
-					// }
-					if (!ShouldProcessFile(entry.path().string(), file_cache)) {
-						continue;
-					}
+struct file_job_t
+{
+	std::string              path;
+	std::vector<task_action> chain;
+	// format+compress 的压缩输出路径
+	std::string compress_output;
+	uint64_t    params_hash = 0;
+	size_t      size        = 0;
+};
 
-					bool is_excluded = false;
-					for (const auto& ex : exclude) {
-						// if (abs_path.compare(0, ex.string().size(), ex.string()) == 0) {
-						if (path.compare(0, ex.string().size(), ex.string()) == 0) {
-							is_excluded = true;
-							break;
-						}
-					}
-					// 文件路径被排除，不加入任务清单
-					if (is_excluded) {
-						continue;
-					}
-					// compress_tasks.push_back(abs_path);
-					compress_tasks.push_back(path);
+// 按路径把任务编译成处理链：同一路径上的任务按任务顺序依次执行，不同路径之间没有依赖。
+// 各任务的目录并发遍历，再按任务顺序合并
+static std::vector<file_job_t> CompileJobs(const json& tasks, const dlfmt_options& options,
+										   std::vector<std::string>* directories = nullptr)
+{
+	std::vector<task_action> actions(tasks.size());
+	std::vector<char>        valid(tasks.size(), 0);
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		const auto& task = tasks[i];
+		if (task["type"] == "format") {
+			actions[i] = task_action::format;
+		}
+		else if (task["type"] == "compress") {
+			actions[i] = task_action::compress;
+		}
+		else if (task["type"] == "format+compress") {
+			if (!task.contains("output")) {
+				SPDLOG_ERROR("No output directory specified for format+compress task: {}",
+							 task["directory"].get<std::string>());
+				continue;
+			}
+			actions[i] = task_action::format_compress;
+		}
+		else {
+			continue;
+		}
+		valid[i] = 1;
+	}
+
+	std::vector<std::vector<std::string>> task_files(tasks.size());
+	std::vector<std::vector<std::string>> task_directories(directories ? tasks.size() : 0);
+	std::vector<std::exception_ptr>       collect_errors(tasks.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(tasks.size()); ++i) {
+		if (valid[i]) {
+			try {
+				task_files[i] = CollectTaskFiles(
+					tasks[i],
+					options.changed_files ? &*options.changed_files : nullptr,
+					directories ? &task_directories[i] : nullptr);
+			}
+			catch (...) {
+				collect_errors[i] = std::current_exception();
+			}
+		}
+	}
+	for (const auto& error : collect_errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+	if (directories) {
+		for (auto& dirs : task_directories) {
+			directories->insert(directories->end(), dirs.begin(), dirs.end());
+		}
+		std::sort(directories->begin(), directories->end());
+		directories->erase(std::unique(directories->begin(), directories->end()),
+						   directories->end());
+	}
+
+	std::vector<file_job_t>                 jobs;
+	std::unordered_map<std::string, size_t> job_index;
+	// 分片键取相对第一个包含该文件的任务目录的路径
+	std::vector<std::string> shard_keys;
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		for (auto& path : task_files[i]) {
+			const auto [it, inserted] = job_index.try_emplace(path, jobs.size());
+			if (inserted) {
+				jobs.push_back({path, {}, {}, 0, 0});
+				if (options.shard_count > 1) {
+					shard_keys.push_back(ShardKey(path, tasks[i]["directory"].get<std::string>()));
 				}
 			}
+			auto& job = jobs[it->second];
+			if (actions[i] == task_action::format_compress) {
+				const auto relative = std::filesystem::path(path).lexically_relative(
+					tasks[i]["directory"].get<std::string>());
+				job.compress_output =
+					(std::filesystem::path(tasks[i]["output"].get<std::string>()) / relative)
+						.string();
+			}
+			job.chain.push_back(actions[i]);
+		}
+	}
+	SelectShard(
+		jobs,
+		options,
+		[](const file_job_t& job) -> const std::string& { return job.path; },
+		[&](size_t i) { return shard_keys[i]; });
+	return jobs;
+}
+
+// 按处理链上的动作统计文件数
+static void ReportJobCounts(const std::vector<const file_job_t*>& jobs)
+{
+	size_t format_count   = 0;
+	size_t compress_count = 0;
+	size_t fanout_count   = 0;
+	for (const auto* job : jobs) {
+		for (const auto action : job->chain) {
+			switch (action) {
+			case task_action::format: ++format_count; break;
+			case task_action::compress: ++compress_count; break;
+			case task_action::format_compress: ++fanout_count; break;
+			}
 		}
-		else if (task["type"] == "format") {
-			std::vector<std::filesystem::path> exclude;
-			if (task.contains("exclude")) {
-				for (const auto& ex : task["exclude"]) {
-					// exclude.push_back(std::filesystem::absolute(work_dir /
-					// ex.get<std::string>()));
-					exclude.push_back(std::filesystem::path(ex.get<std::string>()));
+	}
+	SPDLOG_INFO("{} files to format collected.", format_count);
+	SPDLOG_INFO("{} files to compress collected.", compress_count);
+	if (fanout_count) {
+		SPDLOG_INFO("{} files to format and compress collected.", fanout_count);
+	}
+}
+
+/**
+ * @brief 并行执行处理链，jobs 会按文件大小重新排序，大文件先开始
+ * @details 所有处理链放进同一个调度，没有 format / compress 之间的栅栏。
+ * 每条链完成后立刻记下缓存记录：以最后一步的输出为准，任何一步失败时记录为空
+ *
+ * @return 与排序后的 jobs 一一对应的缓存记录
+ */
+static std::vector<std::optional<file_cache_t>> RunJobs(std::vector<const file_job_t*>& jobs,
+														dlfmt_param          param_format,
+														dlfmt_param          param_compress,
+														const dlfmt_options& options)
+{
+	// 大文件先开始，避免最后只剩一个慢文件在跑
+	std::stable_sort(jobs.begin(), jobs.end(), [](const auto* a, const auto* b) {
+		return a->size > b->size;
+	});
+
+	const auto budget       = MakeMemoryBudget(options);
+	const auto result_cache = OpenResultCache(options);
+
+	std::vector<std::optional<file_cache_t>> records(jobs.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(jobs.size()); ++i) {
+		const auto&       job    = *jobs[i];
+		task_action       action = job.chain.front();
+		dlfmt_file_result result;
+		try {
+			RunStats::FileScope stats_scope(options.stats, job.path);
+			for (const auto step : job.chain) {
+				action = step;
+				MemoryBudget::Ticket ticket(budget.get(), FileSizeOrZero(job.path));
+				switch (step) {
+				case task_action::format:
+					result =
+						FormatFile(job.path, param_format, result_cache.get(), options.verify);
+					break;
+				case task_action::compress:
+					result = CompressFile(
+						job.path, param_compress, result_cache.get(), options.verify);
+					break;
+				case task_action::format_compress:
+					result = FormatAndCompressFile(
+								 job.path, job.compress_output, param_format, options.verify)
+								 .format;
+					break;
 				}
+				ticket.SetFootprint(result.footprint);
+			}
+			std::error_code ec;
+			const auto      mtime = std::filesystem::last_write_time(job.path, ec);
+			if (!ec) {
+				records[i] = file_cache_t{
+					result.output_size, FileTimeToNs(mtime), result.output_hash, job.params_hash};
+			}
+		}
+		catch (const std::exception& e) {
+			const char* what = action == task_action::format     ? "Format"
+							   : action == task_action::compress ? "Compress"
+																 : "Format and compress";
+#pragma omp critical
+			{
+				SPDLOG_ERROR("{} failed: {} ({})", what, job.path, e.what());
 			}
+		}
+	}
+	ReportMemoryBudget(budget.get());
+	ReportResultCache(result_cache.get());
+	return records;
+}
 
-			// 遍历目录，收集所有lua文件
-			for (const auto& entry :
-				 std::filesystem::recursive_directory_iterator(task["directory"])) {
-				if (entry.is_regular_file() && entry.path().extension() == ".lua") {
-					// std::string abs_path =
-					// std::filesystem::absolute(entry.path().string()).string();
-					std::string path = entry.path().string();
+/**
+ * @brief 执行 json 任务：按任务缓存跳过没有变化的文件，处理其余文件后更新缓存
+ *
+ * @param processed 不为空时追加本次处理成功的文件与写回后的缓存记录
+ * @param inputs 不为空时追加任务覆盖的全部目录与文件（不论是否需要处理）
+ * @return size_t 处理失败的文件数
+ */
+static size_t RunJsonTask(const json_task_t& task, const dlfmt_options& options,
+						  std::vector<std::pair<std::string, file_cache_t>>* processed,
+						  std::vector<std::string>*                          inputs = nullptr)
+{
+	// 加载任务缓存记录
+	CacheStore file_cache(CACHE_PATH);
 
-					// 文件没有变，不需要加入任务清单
-					// if (!ShouldProcessFile(abs_path, file_cache)) {
-					if (!ShouldProcessFile(path, file_cache)) {
-						continue;
-					}
+	const dlfmt_param       param_format   = task.param_format;
+	const dlfmt_param       param_compress = task.param_compress;
+	std::vector<file_job_t> jobs           = CompileJobs(task.tasks, options, inputs);
+	if (inputs) {
+		for (const auto& job : jobs) {
+			inputs->push_back(job.path);
+		}
+	}
 
-					bool is_excluded = false;
+	// 文件没有变，且压缩输出还在，不需要加入任务清单。判断只读缓存，可以并发
+	std::vector<char>                        stale(jobs.size(), 0);
+	std::vector<std::optional<file_cache_t>> refreshed(jobs.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(jobs.size()); ++i) {
+		auto&       job    = jobs[i];
+		const auto* output = job.compress_output.empty() ? nullptr : &job.compress_output;
+		job.params_hash    = ChainParamsHash(job.chain, param_format, param_compress, output);
+		job.size           = FileSizeOrZero(job.path);
+		std::error_code ec;
+		stale[i] = ShouldProcessFile(job.path, job.params_hash, file_cache, refreshed[i]) ||
+				   (output && !std::filesystem::exists(*output, ec));
+	}
 
-					for (const auto& ex : exclude) {
-						// if (abs_path.compare(0, ex.string().size(), ex.string()) == 0) {
-						if (path.compare(0, ex.string().size(), ex.string()) == 0) {
-							is_excluded = true;
-							break;
-						}
-					}
-					// 文件路径被排除，不加入任务清单
-					if (is_excluded) {
-						continue;
-					}
-					// format_tasks.push_back(abs_path);
-					format_tasks.push_back(path);
+	std::vector<const file_job_t*> stale_jobs;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		if (!stale[i]) {
+			if (refreshed[i]) {
+				file_cache.Put(jobs[i].path, *refreshed[i]);
+			}
+			continue;
+		}
+		stale_jobs.push_back(&jobs[i]);
+	}
+	ReportJobCounts(stale_jobs);
+
+	const std::vector<std::optional<file_cache_t>> records =
+		RunJobs(stale_jobs, param_format, param_compress, options);
+
+	size_t failed = 0;
+	for (size_t i = 0; i < stale_jobs.size(); ++i) {
+		if (records[i]) {
+			file_cache.Put(stale_jobs[i]->path, *records[i]);
+			if (processed) {
+				processed->emplace_back(stale_jobs[i]->path, *records[i]);
+			}
+		}
+		else {
+			file_cache.Erase(stale_jobs[i]->path);
+			++failed;
+		}
+	}
+
+	file_cache.Commit();
+	return failed;
+}
+
+// Makefile 依赖文件里的路径：统一用 / 分隔，转义空格、# 与 $
+static std::string EscapeDepfilePath(const std::string& path)
+{
+	std::string escaped;
+	for (const char c : std::filesystem::path(path).generic_string()) {
+		if (c == ' ' || c == '#') {
+			escaped += '\\';
+		}
+		else if (c == '$') {
+			escaped += '$';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+// 写出 `target: input...`，每个输入一行
+static void WriteDepfile(const std::string& depfile, const std::string& target,
+						 const std::vector<std::string>& inputs)
+{
+	std::string content = EscapeDepfilePath(target) + ":";
+	for (const auto& input : inputs) {
+		content += " \\\n  ";
+		content += EscapeDepfilePath(input);
+	}
+	content += '\n';
+	WriteFile(depfile, content);
+}
+
+size_t JsonTask(const std::string& json_file, const dlfmt_options& options)
+{
+	const bool               want_inputs = !options.depfile.empty();
+	std::vector<std::string> inputs;
+	if (want_inputs) {
+		// 任务文件本身也是输入，改了任务要重新运行
+		inputs.push_back(json_file);
+	}
+	const size_t failed =
+		RunJsonTask(LoadJsonTask(json_file), options, nullptr, want_inputs ? &inputs : nullptr);
+
+	// 依赖文件总是写出，哪怕有文件失败，构建系统也知道下次该看哪些输入；
+	// 戳记只在全部成功时更新，失败的任务下次构建还会再运行
+	if (want_inputs) {
+		WriteDepfile(options.depfile, options.stamp, inputs);
+	}
+	if (!options.stamp.empty()) {
+		if (failed == 0) {
+			WriteFile(options.stamp, {});
+		}
+		else {
+			SPDLOG_ERROR("{} files failed, {} is not updated.", failed, options.stamp);
+		}
+	}
+	return failed;
+}
+
+/**
+ * @brief 读入 --files-from 的文件清单，path 为 "-" 时读标准输入
+ * @details 清单中出现 NUL 时按 NUL 分隔（find -print0、git diff -z），否则按行分隔并去掉行尾的 \r，
+ * 空项跳过。条目可以带 format: 或 compress: 前缀，不带前缀时为 format。
+ * 同一路径出现多次时按出现顺序组成一条处理链；有 --shard 时只留本分片的文件
+ */
+static std::vector<file_job_t> LoadFileList(const std::string&   list_file,
+											  const dlfmt_options& options)
+{
+	const std::string list      = ReadSource(list_file);
+	const char        separator = list.find('\0') != std::string::npos ? '\0' : '\n';
+
+	std::vector<file_job_t>                 jobs;
+	std::unordered_map<std::string, size_t> job_index;
+	size_t                                  begin = 0;
+	while (begin < list.size()) {
+		size_t end = list.find(separator, begin);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		std::string_view entry(list.data() + begin, end - begin);
+		begin = end + 1;
+		if (separator == '\n' && !entry.empty() && entry.back() == '\r') {
+			entry.remove_suffix(1);
+		}
+
+		task_action action = task_action::format;
+		if (entry.rfind("format:", 0) == 0) {
+			entry.remove_prefix(std::strlen("format:"));
+		}
+		else if (entry.rfind("compress:", 0) == 0) {
+			entry.remove_prefix(std::strlen("compress:"));
+			action = task_action::compress;
+		}
+		if (entry.empty()) {
+			continue;
+		}
+
+		const auto [it, inserted] = job_index.try_emplace(std::string(entry), jobs.size());
+		if (inserted) {
+			jobs.push_back({it->first, {}, {}, 0, 0});
+		}
+		jobs[it->second].chain.push_back(action);
+	}
+	// 清单里的路径按当前目录解释，分片键也相对当前目录
+	SelectShard(
+		jobs,
+		options,
+		[](const file_job_t& job) -> const std::string& { return job.path; },
+		[&](size_t i) { return ShardKey(jobs[i].path, "."); });
+	return jobs;
+}
+
+size_t FilesFrom(const std::string& list_file, dlfmt_param param, const dlfmt_options& options)
+{
+	std::vector<file_job_t> jobs = LoadFileList(list_file, options);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(jobs.size()); ++i) {
+		jobs[i].size = FileSizeOrZero(jobs[i].path);
+	}
+
+	std::vector<const file_job_t*> pending;
+	pending.reserve(jobs.size());
+	for (const auto& job : jobs) {
+		pending.push_back(&job);
+	}
+	ReportJobCounts(pending);
+
+	// 没有任务缓存，记录只用来统计失败的文件
+	const std::vector<std::optional<file_cache_t>> records =
+		RunJobs(pending, param, dlfmt_param::auto_format, options);
+	return static_cast<size_t>(std::count(records.begin(), records.end(), std::nullopt));
+}
+
+// 一阵改动之后安静这么久才开始处理，git checkout、编辑器的保存都会在这段时间内写完
+static constexpr int WATCH_QUIET_MS = 200;
+// 改动持续不断时，距第一个改动最多等这么久
+static constexpr int WATCH_MAX_DELAY_MS = 2000;
+
+// 文件仍是 dlfmt 上次写回的内容：大小与 mtime 都相同，或者大小相同且内容哈希相同
+static bool MatchesRecord(const std::string& path, const file_cache_t& record)
+{
+	std::error_code ec;
+	const auto      size = std::filesystem::file_size(path, ec);
+	if (ec || size != record.size) {
+		return false;
+	}
+	const auto mtime = std::filesystem::last_write_time(path, ec);
+	if (!ec && FileTimeToNs(mtime) == record.mtime_ns) {
+		return true;
+	}
+	try {
+		return xxhash64(ReadFile(path)) == record.hash;
+	}
+	catch (...) {
+		return false;
+	}
+}
+
+void Watch(const std::string& target, dlfmt_param param, const dlfmt_options& options)
+{
+	std::error_code ec;
+	const bool      json_mode = std::filesystem::is_regular_file(target, ec);
+
+	json_task_t              task;
+	std::vector<std::string> directories;
+	if (json_mode) {
+		task = LoadJsonTask(target);
+		for (const auto& t : task.tasks) {
+			directories.push_back(t["directory"].get<std::string>());
+		}
+	}
+	else {
+		directories.push_back(target);
+	}
+
+	// 先开始监视再做第一遍处理，处理期间用户的改动不会漏掉
+	FileWatcher watcher(directories);
+
+	// dlfmt 写回后各文件的记录，键为规范化的绝对路径，用来认出自己写回引起的事件
+	std::unordered_map<std::string, file_cache_t> written;
+	dlfmt_options                                  batch_options = options;
+
+	// changed 为空时处理全部文件
+	const auto process = [&](std::optional<std::vector<std::string>> changed) {
+		batch_options.changed_files = std::move(changed);
+		std::vector<std::pair<std::string, file_cache_t>> processed;
+		if (json_mode) {
+			// 任务缓存照常读写，与单次运行的 --json-task 共用
+			RunJsonTask(task, batch_options, &processed);
+		}
+		else {
+			const std::vector<std::string> files = CollectLuaFiles(target, batch_options);
+			std::vector<file_job_t>        jobs;
+			jobs.reserve(files.size());
+			for (const auto& path : files) {
+				jobs.push_back({path, {task_action::format}, {}, 0, FileSizeOrZero(path)});
+			}
+			std::vector<const file_job_t*> pending;
+			pending.reserve(jobs.size());
+			for (const auto& job : jobs) {
+				pending.push_back(&job);
+			}
+			const auto records = RunJobs(pending, param, dlfmt_param::auto_format, batch_options);
+			for (size_t i = 0; i < pending.size(); ++i) {
+				if (records[i]) {
+					processed.emplace_back(pending[i]->path, *records[i]);
 				}
 			}
 		}
+		for (auto& [path, record] : processed) {
+			std::error_code canonical_ec;
+			const auto canonical = std::filesystem::weakly_canonical(path, canonical_ec);
+			written[canonical_ec ? path : canonical.string()] = record;
+		}
+	};
+
+	process(std::nullopt);
+	SPDLOG_INFO("Watching {} for changes.", target);
+	for (;;) {
+		FileWatcher::batch batch = watcher.Wait(WATCH_QUIET_MS, WATCH_MAX_DELAY_MS);
+		const auto         start = std::chrono::steady_clock::now();
+		if (batch.overflow) {
+			SPDLOG_WARN("Too many file events at once, processing everything again.");
+			process(std::nullopt);
+			continue;
+		}
+
+		std::vector<std::string> changed;
+		for (auto& path : batch.files) {
+			const auto it = written.find(path);
+			if (it != written.end() && MatchesRecord(path, it->second)) {
+				continue;
+			}
+			changed.push_back(std::move(path));
+		}
+		if (changed.empty()) {
+			continue;
+		}
+		const size_t count = changed.size();
+		process(std::move(changed));
+		SPDLOG_INFO("Processed {} changed files in {} ms.",
+					count,
+					std::chrono::duration_cast<std::chrono::milliseconds>(
+						std::chrono::steady_clock::now() - start)
+						.count());
 	}
+}
+
+struct file_check_t
+{
+	size_t footprint = 0;
+	// 第一处不同所在的行（从 1 开始），0 表示无需改写
+	size_t line = 0;
+	// 只在 diff 模式下生成
+	std::string diff;
+};
+
+// 第一处不同的字节在 text 中的偏移所在的行
+static size_t LineAt(const std::string& text, size_t offset)
+{
+	return 1 + static_cast<size_t>(std::count(
+				   text.begin(), text.begin() + static_cast<std::ptrdiff_t>(offset), '\n'));
+}
 
-	SPDLOG_INFO("{} files to format collected.", format_tasks.size());
-	SPDLOG_INFO("{} files to compress collected.", compress_tasks.size());
+/**
+ * @brief 分词、解析后把打印结果与原文比较，不写文件
+ * @details 不要 diff 时打印结果不保存，逐块与原文比较，比出第一处不同的字节后就不再打印后面的顶层语句；
+ * 要 diff 时打印到内存，再按行求 unified diff
+ */
+template<TokenizeMode tokenize_mode, AstPrintMode print_mode>
+static file_check_t CheckSource(const std::string& path, bool diff)
+{
+	std::string              content = ReadFile(path);
+	RunStats::PhaseClock     clock;
+	Tokenizer<tokenize_mode> tokenizer(std::move(content), path);
+	clock.Lap(stats_phase::tokenize);
+	Parser parser(tokenizer.getTokens(), path);
+	clock.Lap(stats_phase::parse);
+	RunStats::AddCounts(tokenizer.getTokens().size(), parser.NodeCount());
+	const std::string& text = tokenizer.getText();
 
-// 然后处理任务。先 format，后 compress
-#pragma omp parallel for
-	for (int i = 0; i < static_cast<int>(format_tasks.size()); ++i) {
-		const auto& abs_path = format_tasks[i];
-		FormatFile(abs_path, param_format);
+	file_check_t result;
+	result.footprint = tokenizer.MemoryUsage() + parser.MemoryUsage();
+	if (diff) {
+		std::string output;
+		output.reserve(text.size() + text.size() / 4);
+		AstPrinter<print_mode, std::string> printer(output, &tokenizer.getCommentTokens());
+		printer.PrintAst(parser.GetAstRoot());
+		clock.Lap(stats_phase::print);
+		result.footprint += sizeof(printer) + output.capacity();
+		if (output != text) {
+			const size_t common = static_cast<size_t>(
+				std::mismatch(text.begin(), text.end(), output.begin(), output.end()).first -
+				text.begin());
+			result.line = LineAt(text, common);
+			UnifiedDiff(text, output, path, result.diff);
+		}
+		return result;
 	}
 
-#pragma omp parallel for
-	for (int i = 0; i < static_cast<int>(compress_tasks.size()); ++i) {
-		const auto& abs_path = compress_tasks[i];
-		CompressFile(abs_path, param_compress);
+	OutputComparer                         comparer(text);
+	AstPrinter<print_mode, OutputComparer> printer(comparer, &tokenizer.getCommentTokens());
+	printer.PrintAstUntil(parser.GetAstRoot(), [&comparer] { return comparer.Differs(); });
+	clock.Lap(stats_phase::print);
+	result.footprint += sizeof(printer);
+	if (!comparer.Same()) {
+		result.line = LineAt(text, comparer.Mismatch());
 	}
+	return result;
+}
 
-	for (const auto& abs_path : format_tasks) {
-		std::error_code ec;
-		auto            mtime = std::filesystem::last_write_time(abs_path, ec);
-		if (ec) continue;
-		int64_t s_mtime      = FileTimeTypeToTimeT(mtime);
-		file_cache[abs_path] = s_mtime;
+static file_check_t CheckFormatted(const std::string& path, dlfmt_param param, bool diff)
+{
+	switch (param) {
+	case dlfmt_param::manual_format:
+		return CheckSource<TokenizeMode::FormatManual, AstPrintMode::Manual>(path, diff);
+	default: return CheckSource<TokenizeMode::FormatAuto, AstPrintMode::Auto>(path, diff);
 	}
+}
 
-	for (const auto& abs_path : compress_tasks) {
-		std::error_code ec;
-		auto            mtime = std::filesystem::last_write_time(abs_path, ec);
-		if (ec) continue;
-		int64_t s_mtime      = FileTimeTypeToTimeT(mtime);
-		file_cache[abs_path] = s_mtime;
+static file_check_t CheckCompressed(const std::string& path, bool diff)
+{
+	return CheckSource<TokenizeMode::Compress, AstPrintMode::Compress>(path, diff);
+}
+
+// 并行检查 files，check(i) 检查第 i 个文件
+template<typename Check>
+static dlfmt_check_result CheckFiles(const std::vector<std::string>& files,
+									 const dlfmt_options& options, Check&& check)
+{
+	const auto                budget = MakeMemoryBudget(options);
+	std::vector<file_check_t> checks(files.size());
+	std::vector<char>         failed(files.size(), 0);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+		try {
+			RunStats::FileScope  stats_scope(options.stats, files[i]);
+			MemoryBudget::Ticket ticket(budget.get(), FileSizeOrZero(files[i]));
+			checks[i] = check(i);
+			ticket.SetFootprint(checks[i].footprint);
+		}
+		catch (const std::exception& e) {
+			failed[i] = 1;
+#pragma omp critical
+			{
+				SPDLOG_ERROR("Check failed: {} ({})", files[i], e.what());
+			}
+		}
+	}
+	ReportMemoryBudget(budget.get());
+
+	dlfmt_check_result result;
+	result.checked = files.size();
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (failed[i]) {
+			result.failed.push_back(files[i]);
+		}
+		else if (checks[i].line) {
+			result.changed.push_back({files[i], checks[i].line, std::move(checks[i].diff)});
+		}
+	}
+	return result;
+}
+
+dlfmt_check_result CheckFile(const std::string& check_file, dlfmt_param param, bool diff)
+{
+	return CheckFiles({check_file}, dlfmt_options{}, [&](int) {
+		return CheckFormatted(check_file, param, diff);
+	});
+}
+
+dlfmt_check_result CheckDirectory(const std::string& check_directory, dlfmt_param param,
+								  const dlfmt_options& options, bool diff)
+{
+	if (check_directory.empty()) {
+		SPDLOG_ERROR("No directory specified for checking.");
+		throw std::invalid_argument("No directory specified for checking.");
+	}
+	const std::vector<std::string> files = CollectLuaFiles(check_directory, options);
+	return CheckFiles(files, options, [&](int i) { return CheckFormatted(files[i], param, diff); });
+}
+
+// 文件最终由链上最后一次改写决定；压缩只看 token，先格式化再压缩与直接压缩结果相同
+static dlfmt_check_result CheckJobs(const std::vector<const file_job_t*>& jobs,
+									dlfmt_param param_format, const dlfmt_options& options,
+									bool diff)
+{
+	std::vector<std::string> files;
+	std::vector<char>        compress;
+	files.reserve(jobs.size());
+	compress.reserve(jobs.size());
+	for (const auto* job : jobs) {
+		files.push_back(job->path);
+		compress.push_back(job->chain.back() == task_action::compress);
+	}
+	return CheckFiles(files, options, [&](int i) {
+		return compress[i] ? CheckCompressed(files[i], diff)
+						   : CheckFormatted(files[i], param_format, diff);
+	});
+}
+
+dlfmt_check_result CheckJsonTask(const std::string& json_file, const dlfmt_options& options,
+								 bool diff)
+{
+	const json_task_t       task = LoadJsonTask(json_file);
+	std::vector<file_job_t> jobs = CompileJobs(task.tasks, options);
+
+	// 缓存记录说明文件就是上次处理的结果，参数没变时不必再检查。
+	// 只读缓存：缓存文件不存在时不去创建它
+	std::unique_ptr<CacheStore> file_cache;
+	std::error_code             ec;
+	if (std::filesystem::exists(CACHE_PATH, ec) ||
+		std::filesystem::exists(std::string(CACHE_PATH) + ".journal", ec)) {
+		file_cache = std::make_unique<CacheStore>(CACHE_PATH);
+	}
+	std::vector<char> stale(jobs.size(), 1);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(jobs.size()); ++i) {
+		auto&       job    = jobs[i];
+		const auto* output = job.compress_output.empty() ? nullptr : &job.compress_output;
+		job.params_hash =
+			ChainParamsHash(job.chain, task.param_format, task.param_compress, output);
+		if (file_cache) {
+			std::optional<file_cache_t> refreshed;
+			stale[i] = ShouldProcessFile(job.path, job.params_hash, *file_cache, refreshed);
+		}
+	}
+
+	std::vector<const file_job_t*> stale_jobs;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		if (stale[i]) {
+			stale_jobs.push_back(&jobs[i]);
+		}
+	}
+	SPDLOG_INFO("{} files to check collected, {} unchanged since the last run.",
+				stale_jobs.size(),
+				jobs.size() - stale_jobs.size());
+
+	dlfmt_check_result result = CheckJobs(stale_jobs, task.param_format, options, diff);
+	result.checked            = jobs.size();
+	return result;
+}
+
+dlfmt_check_result CheckFilesFrom(const std::string& list_file, dlfmt_param param,
+								  const dlfmt_options& options, bool diff)
+{
+	const std::vector<file_job_t>  jobs = LoadFileList(list_file, options);
+	std::vector<const file_job_t*> pending;
+	pending.reserve(jobs.size());
+	for (const auto& job : jobs) {
+		pending.push_back(&job);
+	}
+	SPDLOG_INFO("{} files to check collected.", pending.size());
+	return CheckJobs(pending, param, options, diff);
+}
+
+int ReportCheck(dlfmt_check_result& result, bool print_diff, bool fail_on_change)
+{
+	std::sort(result.changed.begin(),
+			  result.changed.end(),
+			  [](const dlfmt_changed_file& a, const dlfmt_changed_file& b) {
+				  return a.path < b.path;
+			  });
+	std::sort(result.failed.begin(), result.failed.end());
+	for (const auto& changed : result.changed) {
+		if (print_diff) {
+			fwrite(changed.diff.data(), 1, changed.diff.size(), stdout);
+		}
+		else {
+			printf("%s:%zu\n", changed.path.c_str(), changed.line);
+		}
+	}
+	fflush(stdout);
+	SPDLOG_INFO("{} of {} files would be reformatted.", result.changed.size(), result.checked);
+	if (!result.failed.empty()) {
+		SPDLOG_ERROR("{} files could not be checked.", result.failed.size());
+		return 1;
+	}
+	return fail_on_change && !result.changed.empty() ? 1 : 0;
+}
+
+std::vector<std::string> CheckSyntax(const std::string& path)
+{
+	std::error_code                ec;
+	const std::vector<std::string> files = std::filesystem::is_directory(path, ec)
+											   ? CollectLuaFiles(path, dlfmt_options{})
+											   : std::vector<std::string>{path};
+
+	std::vector<std::string> errors(files.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+		try {
+			Tokenizer<TokenizeMode::Compress> tokenizer(ReadFile(files[i]), files[i]);
+			Parser::Validate(tokenizer.getTokens(), files[i]);
+		}
+		catch (const std::exception& e) {
+			errors[i] = e.what();
+		}
 	}
 
-	json cache_out_j;
-	for (const auto& [k, v] : file_cache) {
-		cache_out_j[k] = v;
+	std::vector<std::pair<std::string, std::string>> failed;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (!errors[i].empty()) {
+			failed.emplace_back(files[i], std::move(errors[i]));
+		}
 	}
-	std::ofstream cache_out(cache_path);
-	cache_out << cache_out_j.dump();
-	cache_out.close();
-}
\ No newline at end of file
+	std::sort(failed.begin(), failed.end());
+	SPDLOG_INFO("{} of {} files have syntax errors.", failed.size(), files.size());
+
+	std::vector<std::string> result;
+	result.reserve(failed.size());
+	for (auto& [file, error] : failed) {
+		result.push_back(std::move(error));
+	}
+	return result;
+}
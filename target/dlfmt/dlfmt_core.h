@@ -1,10 +1,19 @@
 
+#include <cstdint>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <omp.h>
+#include <optional>
+#include <ostream>
 #include <spdlog/common.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+class RunStats;
 
 enum class dlfmt_mode{
     show_help,
@@ -13,7 +22,12 @@ enum class dlfmt_mode{
     format_directory,
     compress_file,
     compress_directory,
-    json_task
+    json_task,
+    files_from,
+    watch,
+    check_syntax,
+    server,
+    lsp
 };
 
 enum class dlfmt_param{
@@ -21,16 +35,211 @@ enum class dlfmt_param{
     manual_format
 };
 
+struct dlfmt_options
+{
+	// 并发处理时的内存预算（字节），0 表示不限制
+	size_t max_memory = 0;
+	// 用户级结果缓存目录，空表示不使用
+	std::string result_cache_dir;
+	size_t      result_cache_size = size_t(1) << 30;
+	// 写回之前校验打印结果的 token 序列与原文一致
+	bool verify = false;
+	// --changed-since 查到的改动文件（绝对路径）。有值时目录与 json 任务只处理其中的文件，不再遍历目录
+	std::optional<std::vector<std::string>> changed_files;
+	// 结果写到这个目录下的同一相对路径，不改写源文件；空表示原地改写
+	std::string output_dir;
+	// 上一代输出目录，仍然有效的输出从这里链接过来
+	std::string link_dest;
+	// json 任务的依赖文件与戳记文件，供 Make / Ninja 判断是否需要运行
+	std::string depfile;
+	std::string stamp;
+	// --stats 的统计，空表示不统计
+	RunStats* stats = nullptr;
+	// --shard：文件分成 shard_count 片，只处理第 shard_index 片（从 0 开始）
+	size_t shard_index = 0;
+	size_t shard_count = 1;
+};
+
+class ResultCache;
+
 void ShowHelp();
 
 void ShowVersion();
 
-void FormatFile(const std::string& format_file, dlfmt_param param);
+struct dlfmt_file_result
+{
+	// 处理该文件时的内存占用估计（字节）
+	size_t footprint = 0;
+	// 写回内容的大小与 xxhash64
+	size_t   output_size = 0;
+	uint64_t output_hash = 0;
+};
+
+/**
+ * @brief 格式化并写回
+ * @details verify 时写回之前按原文的 token 表扫描输出，逐个 memcmp，注释也须按顺序出现。
+ * 只允许打印器有意的改动：省略可选的 `;`，表构造中的分隔符换成 `,`，去掉末尾的分隔符；
+ * 原文中分开的两个 token 被连写成可能读作别的 token 时（如 `- -1` 变成 `--1`）同样视为失败。
+ * 校验失败时抛出异常，文件保持原样
+ */
+dlfmt_file_result FormatFile(const std::string& format_file, dlfmt_param param,
+							 ResultCache* result_cache = nullptr, bool verify = false);
+
+void FormatDirectory(const std::string& format_directory, dlfmt_param param,
+					 const dlfmt_options& options);
+
+dlfmt_file_result CompressFile(const std::string& compress_file, [[maybe_unused]] dlfmt_param param,
+							   ResultCache* result_cache = nullptr, bool verify = false);
+
+/**
+ * @brief 按 options 打开结果缓存，未配置时返回空
+ *
+ */
+std::unique_ptr<ResultCache> OpenResultCache(const dlfmt_options& options);
+
+/**
+ * @brief 处理内存中的源码，不读写文件。name 只用于报错；output 的容量会被复用
+ *
+ */
+void FormatBuffer(std::string&& content, dlfmt_param param, const std::string& name,
+				  std::string& output);
+
+void CompressBuffer(std::string&& content, const std::string& name, std::string& output);
+
+struct dlfmt_range
+{
+	// bytes 为真时是字节偏移 [begin, end)，否则是行号 [begin, end]（从 1 开始）
+	size_t begin = 0;
+	size_t end   = 0;
+	bool   bytes = false;
+};
+
+/**
+ * @brief 解析 --range 的参数：10:20 表示第 10 到 20 行，100b:200b 表示字节偏移，单个 10 表示一行
+ *
+ * @return false 参数格式错误或数字溢出
+ */
+bool ParseRange(const std::string& text, dlfmt_range& range);
+
+/**
+ * @brief 只重新打印 content 中与 range 相交的语句，其余内容原样保留，结果写入 output
+ *
+ */
+void FormatRangeBuffer(std::string&& content, dlfmt_param param, const dlfmt_range& range,
+					   const std::string& name, std::string& output);
+
+/**
+ * @brief 区间格式化一个文件，内容不变时不写回
+ *
+ */
+void FormatFileRange(const std::string& format_file, dlfmt_param param, const dlfmt_range& range);
+
+/**
+ * @brief 读入源码，path 为 "-" 时读标准输入
+ *
+ */
+std::string ReadSource(const std::string& path);
+
+/**
+ * @brief 处理内存中的源码，打印器经自己的缓冲区直接写入 out，不拼中间字符串。
+ * 解析失败时抛出异常，且不会向 out 写入任何内容
+ *
+ */
+void FormatStream(std::string&& content, dlfmt_param param, const std::string& name,
+				  std::ostream& out);
+
+void CompressStream(std::string&& content, const std::string& name, std::ostream& out);
+
+struct dlfmt_fanout_result
+{
+	dlfmt_file_result format;
+	dlfmt_file_result compress;
+};
+
+/**
+ * @brief 一次分词与解析，格式化结果写回原文件，压缩结果写到 compress_file
+ *
+ */
+dlfmt_fanout_result FormatAndCompressFile(const std::string& source_file,
+										  const std::string& compress_file, dlfmt_param param,
+										  bool verify = false);
+
+void CompressDirectory(const std::string& compress_directory, [[maybe_unused]] dlfmt_param param,
+					   const dlfmt_options& options);
+
+/**
+ * @brief 执行 json 任务。options.depfile 不为空时写出依赖文件，列出任务文件与任务覆盖的全部目录、文件；
+ * options.stamp 不为空且全部文件处理成功时更新戳记文件
+ *
+ * @return size_t 处理失败的文件数
+ */
+size_t JsonTask(const std::string& json_file, const dlfmt_options& options);
+
+/**
+ * @brief 处理清单中列出的文件，与目录、json 任务共用同一个并行调度，不读写任务缓存。
+ * list_file 为 "-" 时从标准输入读清单；清单按换行或 NUL 分隔，条目可带 format: / compress: 前缀
+ *
+ * @return size_t 处理失败的文件数
+ */
+size_t FilesFrom(const std::string& list_file, dlfmt_param param, const dlfmt_options& options);
+
+struct dlfmt_changed_file
+{
+	std::string path;
+	// 第一处不同所在的行（从 1 开始）
+	size_t line = 0;
+	// unified diff，只在要求 diff 时生成
+	std::string diff;
+};
+
+struct dlfmt_check_result
+{
+	// 会被改写的文件
+	std::vector<dlfmt_changed_file> changed;
+	// 读入或解析失败的文件
+	std::vector<std::string> failed;
+	size_t                   checked = 0;
+};
+
+/**
+ * @brief 只检查不写回。不要 diff 时打印结果与原文逐块比较，比出第一处不同即停；
+ * 要 diff 时打印到内存，再求 unified diff
+ *
+ */
+dlfmt_check_result CheckFile(const std::string& check_file, dlfmt_param param, bool diff = false);
+
+dlfmt_check_result CheckDirectory(const std::string& check_directory, dlfmt_param param,
+								  const dlfmt_options& options, bool diff = false);
+
+/**
+ * @brief 检查 json 任务中的文件：每个文件按处理链上最后一次改写比较，缓存记录未变的文件直接跳过。
+ * 不写缓存，也不写压缩输出
+ *
+ */
+dlfmt_check_result CheckJsonTask(const std::string& json_file, const dlfmt_options& options,
+								 bool diff = false);
 
-void FormatDirectory(const std::string& format_directory, dlfmt_param param);
+/**
+ * @brief 常驻监视：先完整处理一遍，之后只处理发生改动的 .lua 文件，不会返回
+ * @details target 为目录时格式化其中的文件，为 json 文件时执行其中的任务，并照常读写任务缓存。
+ * 一阵密集的改动合并成一批处理；文件内容仍是 dlfmt 自己写回的结果时，对应的事件被忽略
+ */
+void Watch(const std::string& target, dlfmt_param param, const dlfmt_options& options);
 
-void CompressFile(const std::string& compress_file, [[maybe_unused]] dlfmt_param param);
+dlfmt_check_result CheckFilesFrom(const std::string& list_file, dlfmt_param param,
+								  const dlfmt_options& options, bool diff = false);
 
-void CompressDirectory(const std::string& compress_directory, [[maybe_unused]] dlfmt_param param);
+/**
+ * @brief 按路径排序后向 stdout 输出会被改写的文件：print_diff 时输出各文件的 unified diff，
+ * 否则每行一个 path:line
+ *
+ * @return int 退出码：有文件检查失败，或 fail_on_change 且有文件会被改写时为 1
+ */
+int ReportCheck(dlfmt_check_result& result, bool print_diff, bool fail_on_change);
 
-void JsonTask(const std::string& json_file);
\ No newline at end of file
+/**
+ * @brief 只检查语法：压缩模式分词，解析时不保留语法树，只读不写。path 可以是文件或目录
+ *
+ * @return 每个出错文件的错误信息（file:line: message），按路径排序；全部通过时为空
+ */
+std::vector<std::string> CheckSyntax(const std::string& path);
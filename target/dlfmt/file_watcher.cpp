@@ -0,0 +1,174 @@
+#include "file_watcher.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#ifdef __linux__
+#	include <cerrno>
+#	include <poll.h>
+#	include <sys/inotify.h>
+#	include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+namespace {
+// 目录被删除时内核会发 IN_IGNORED，不必订阅 IN_DELETE_SELF；目录在树内改名时，
+// 对新路径再 add_tree 会拿到同一个 wd，路径随之更新
+constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+bool is_lua_file(const std::filesystem::path& path)
+{
+	return path.extension() == ".lua";
+}
+}   // namespace
+
+FileWatcher::FileWatcher(const std::vector<std::string>& directories)
+{
+	fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd_ < 0) {
+		throw std::system_error(errno, std::generic_category(), "inotify_init1");
+	}
+	for (const auto& directory : directories) {
+		add_tree(directory, nullptr);
+	}
+}
+
+FileWatcher::~FileWatcher()
+{
+	if (fd_ >= 0) {
+		close(fd_);
+	}
+}
+
+void FileWatcher::add_tree(const std::string& directory, std::vector<std::string>* files)
+{
+	std::error_code ec;
+	const auto      root = std::filesystem::weakly_canonical(directory, ec).string();
+	if (ec) {
+		return;
+	}
+	const auto add = [this](const std::string& path) {
+		const int wd = inotify_add_watch(fd_, path.c_str(), WATCH_MASK);
+		if (wd < 0) {
+			// 目录在遍历过程中被删掉时直接跳过，其余错误（如 max_user_watches 用尽）报给调用方
+			if (errno == ENOENT || errno == ENOTDIR) {
+				return;
+			}
+			throw std::system_error(errno, std::generic_category(), "inotify_add_watch " + path);
+		}
+		directories_[wd] = path;
+	};
+	add(root);
+	for (auto it = std::filesystem::recursive_directory_iterator(
+			 root, std::filesystem::directory_options::skip_permission_denied, ec);
+		 !ec && it != std::filesystem::recursive_directory_iterator();
+		 it.increment(ec)) {
+		if (it->is_directory(ec)) {
+			add(it->path().string());
+		}
+		else if (files && it->is_regular_file(ec) && is_lua_file(it->path())) {
+			files->push_back(it->path().string());
+		}
+	}
+}
+
+bool FileWatcher::read_events(int timeout_ms, batch& out)
+{
+	pollfd pfd{fd_, POLLIN, 0};
+	const int ready = poll(&pfd, 1, timeout_ms);
+	if (ready < 0) {
+		if (errno == EINTR) {
+			return false;
+		}
+		throw std::system_error(errno, std::generic_category(), "poll");
+	}
+	if (ready == 0) {
+		return false;
+	}
+
+	alignas(inotify_event) char buffer[64 * 1024];
+	for (;;) {
+		const ssize_t length = read(fd_, buffer, sizeof(buffer));
+		if (length < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				break;
+			}
+			throw std::system_error(errno, std::generic_category(), "read inotify");
+		}
+		for (const char* p = buffer; p < buffer + length;) {
+			const auto* event = reinterpret_cast<const inotify_event*>(p);
+			p += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				out.overflow = true;
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				directories_.erase(event->wd);
+				continue;
+			}
+			const auto directory = directories_.find(event->wd);
+			if (directory == directories_.end() || event->len == 0) {
+				continue;
+			}
+			const std::string path =
+				(std::filesystem::path(directory->second) / event->name).string();
+			if (event->mask & IN_ISDIR) {
+				// 新目录里的文件可能在加上监视之前就已写完，一并算作改动
+				if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+					add_tree(path, &out.files);
+				}
+			}
+			else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_lua_file(path)) {
+				out.files.push_back(path);
+			}
+		}
+	}
+	return true;
+}
+
+FileWatcher::batch FileWatcher::Wait(int quiet_ms, int max_delay_ms)
+{
+	using clock = std::chrono::steady_clock;
+	batch out;
+	while (out.files.empty() && !out.overflow) {
+		read_events(-1, out);
+	}
+	const auto deadline = clock::now() + std::chrono::milliseconds(max_delay_ms);
+	for (;;) {
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+							  deadline - clock::now())
+							  .count();
+		if (left <= 0 || !read_events(static_cast<int>(std::min<long long>(quiet_ms, left)), out)) {
+			break;
+		}
+	}
+	std::sort(out.files.begin(), out.files.end());
+	out.files.erase(std::unique(out.files.begin(), out.files.end()), out.files.end());
+	return out;
+}
+
+#else
+
+FileWatcher::FileWatcher(const std::vector<std::string>&)
+{
+	throw std::runtime_error("--watch needs inotify and is only available on Linux");
+}
+
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::add_tree(const std::string&, std::vector<std::string>*) {}
+
+bool FileWatcher::read_events(int, batch&)
+{
+	return false;
+}
+
+FileWatcher::batch FileWatcher::Wait(int, int)
+{
+	return {};
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 递归监视若干目录下 .lua 文件的改动（inotify），把一阵密集的改动合并成一批返回
+ * @details 关心写完关闭（IN_CLOSE_WRITE）与移入（IN_MOVED_TO）两种事件：编辑器先写临时文件再改名、
+ * git checkout 一次改写大量文件，最终都落在这两种事件上。新建或移入的子目录会补上监视，
+ * 并把其中已有的 .lua 文件算作改动。只在 Linux 上可用，其他平台构造时抛出异常
+ */
+class FileWatcher
+{
+public:
+	struct batch
+	{
+		// 改动文件的绝对路径，已去重、排序
+		std::vector<std::string> files;
+		// 内核事件队列溢出，可能漏掉了改动，调用方应当整体重新处理一遍
+		bool overflow = false;
+	};
+
+	explicit FileWatcher(const std::vector<std::string>& directories);
+	~FileWatcher();
+	FileWatcher(const FileWatcher&)            = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	/**
+	 * @brief 阻塞到出现改动，之后继续收集，直到 quiet_ms 内没有新的改动，或距第一个改动已过 max_delay_ms
+	 *
+	 */
+	batch Wait(int quiet_ms, int max_delay_ms);
+
+private:
+	// 监视 directory 及其所有子目录，files 不为空时收集其中已有的 .lua 文件
+	void add_tree(const std::string& directory, std::vector<std::string>* files);
+	// 读出当前可读的全部事件，timeout_ms 内没有事件时返回 false
+	bool read_events(int timeout_ms, batch& out);
+
+	int                                  fd_ = -1;
+	std::unordered_map<int, std::string> directories_;
+};
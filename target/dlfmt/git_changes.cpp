@@ -0,0 +1,122 @@
+#include "git_changes.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+#ifdef _WIN32
+#	define popen _popen
+#	define pclose _pclose
+#endif
+
+namespace {
+// 作为 shell 命令的一个参数转义
+std::string quote_argument(const std::string& arg)
+{
+#ifdef _WIN32
+	std::string quoted = "\"";
+	for (const char c : arg) {
+		if (c == '"') {
+			quoted += '\\';
+		}
+		quoted += c;
+	}
+	return quoted + '"';
+#else
+	std::string quoted = "'";
+	for (const char c : arg) {
+		if (c == '\'') {
+			quoted += "'\\''";
+		}
+		else {
+			quoted += c;
+		}
+	}
+	return quoted + '\'';
+#endif
+}
+
+// 执行命令并读出全部 stdout，命令失败时抛出异常
+std::string run_command(const std::string& command)
+{
+#ifdef _WIN32
+	FILE* pipe = popen(command.c_str(), "rb");
+#else
+	FILE* pipe = popen(command.c_str(), "r");
+#endif
+	if (!pipe) {
+		throw std::runtime_error("Failed to run: " + command);
+	}
+	std::string output;
+	char        buffer[4096];
+	size_t      count = 0;
+	while ((count = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+		output.append(buffer, count);
+	}
+	if (pclose(pipe) != 0) {
+		throw std::runtime_error("Command failed: " + command);
+	}
+	return output;
+}
+}   // namespace
+
+std::vector<std::string> GitChangedFiles(const std::string& rev)
+{
+	// 以 - 开头的 rev 会被 git 当成选项
+	if (rev.empty() || rev.front() == '-') {
+		throw std::invalid_argument("Invalid git revision: " + rev);
+	}
+
+	std::string top_level = run_command("git rev-parse --show-toplevel");
+	while (!top_level.empty() && (top_level.back() == '\n' || top_level.back() == '\r')) {
+		top_level.pop_back();
+	}
+	const std::filesystem::path root(top_level);
+
+	// --no-renames 让改名显示为删除加新增，删除的一侧再被 --diff-filter=d 去掉
+	const std::string names =
+		run_command("git diff --name-only -z --no-renames --diff-filter=d " + quote_argument(rev) +
+					" -- " + quote_argument(":(top)*.lua"));
+
+	std::vector<std::string> files;
+	size_t                   begin = 0;
+	while (begin < names.size()) {
+		size_t end = names.find('\0', begin);
+		if (end == std::string::npos) {
+			end = names.size();
+		}
+		const std::string_view name(names.data() + begin, end - begin);
+		begin = end + 1;
+		if (name.empty()) {
+			continue;
+		}
+		const auto path = (root / std::filesystem::path(name)).lexically_normal();
+		std::error_code ec;
+		if (path.extension() == ".lua" && std::filesystem::is_regular_file(path, ec)) {
+			files.push_back(path.string());
+		}
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+std::vector<std::string> ChangedFilesUnder(const std::string&              directory,
+										   const std::vector<std::string>& changed_files)
+{
+	// git 给出的是解析过符号链接的路径，目录也要解析到同样的写法
+	std::error_code ec;
+	auto            base = std::filesystem::weakly_canonical(std::filesystem::absolute(directory), ec);
+	if (ec) {
+		base = std::filesystem::absolute(directory).lexically_normal();
+	}
+
+	std::vector<std::string> files;
+	for (const auto& changed : changed_files) {
+		const auto relative = std::filesystem::path(changed).lexically_relative(base);
+		if (relative.empty() || *relative.begin() == "..") {
+			continue;
+		}
+		files.push_back((std::filesystem::path(directory) / relative).string());
+	}
+	return files;
+}
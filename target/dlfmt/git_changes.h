@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * @brief 向当前目录所在的 git 仓库查询相对 rev 有改动的 .lua 文件，只读本地仓库，不访问网络
+ * @details 调用 `git diff --name-only -z <rev>`，比较的是工作区与 rev，已暂存与未暂存的改动都算在内；
+ * 删除的文件与未跟踪的文件不算。git 失败（不在仓库内、rev 不存在等）时抛出 std::runtime_error
+ *
+ * @return 改动文件的绝对路径（lexically_normal），按路径排序
+ */
+std::vector<std::string> GitChangedFiles(const std::string& rev);
+
+/**
+ * @brief 从 changed_files 中挑出位于 directory 下的文件，路径以 directory 开头拼接，
+ * 与遍历该目录得到的路径写法一致，exclude 之类的前缀匹配照常可用
+ *
+ */
+std::vector<std::string> ChangedFilesUnder(const std::string&              directory,
+										   const std::vector<std::string>& changed_files);
@@ -0,0 +1,392 @@
+#include "line_diff.h"
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+// 按行切分，每行带着自己的 '\n'，只有最后一行可能没有
+std::vector<std::string_view> split_lines(std::string_view text)
+{
+	std::vector<std::string_view> lines;
+	size_t                        begin = 0;
+	while (begin < text.size()) {
+		const size_t newline = text.find('\n', begin);
+		const size_t end     = newline == std::string_view::npos ? text.size() : newline + 1;
+		lines.push_back(text.substr(begin, end - begin));
+		begin = end;
+	}
+	return lines;
+}
+
+/**
+ * @brief 线性空间的 Myers 算法：每次找中间蛇把区间一分为二，用显式栈代替递归
+ * @details 切分点的搜索超过 too_expensive_ 步时，取两个方向上走得最远的对角线作为切分点（与 GNU diff
+ * 的启发式相同），整体代价约为 O((N + M) * sqrt(N + M))
+ */
+class Myers
+{
+public:
+	Myers(const std::vector<int>& a, const std::vector<int>& b)
+		: a_(a)
+		, b_(b)
+		, fd_(a.size() + b.size() + 3)
+		, bd_(a.size() + b.size() + 3)
+		, offset_(static_cast<int>(b.size()) + 1)
+	{
+		for (size_t diags = a.size() + b.size() + 3; diags != 0; diags >>= 2) {
+			too_expensive_ <<= 1;
+		}
+		too_expensive_ = std::max(too_expensive_, 256);
+	}
+
+	// 标出 a 中被删除、b 中被插入的元素
+	void Compare(std::vector<char>& deleted, std::vector<char>& inserted)
+	{
+		std::vector<range_t> pending;
+		pending.push_back({0, static_cast<int>(a_.size()), 0, static_cast<int>(b_.size())});
+		while (!pending.empty()) {
+			auto [xoff, xlim, yoff, ylim] = pending.back();
+			pending.pop_back();
+			while (xoff < xlim && yoff < ylim && a_[xoff] == b_[yoff]) {
+				++xoff;
+				++yoff;
+			}
+			while (xoff < xlim && yoff < ylim && a_[xlim - 1] == b_[ylim - 1]) {
+				--xlim;
+				--ylim;
+			}
+			if (xoff == xlim) {
+				std::fill(inserted.begin() + yoff, inserted.begin() + ylim, 1);
+			}
+			else if (yoff == ylim) {
+				std::fill(deleted.begin() + xoff, deleted.begin() + xlim, 1);
+			}
+			else {
+				int xmid = 0;
+				int ymid = 0;
+				split(xoff, xlim, yoff, ylim, xmid, ymid);
+				pending.push_back({xoff, xmid, yoff, ymid});
+				pending.push_back({xmid, xlim, ymid, ylim});
+			}
+		}
+	}
+
+private:
+	struct range_t
+	{
+		int xoff;
+		int xlim;
+		int yoff;
+		int ylim;
+	};
+
+	int& fd(int diagonal) { return fd_[diagonal + offset_]; }
+	int& bd(int diagonal) { return bd_[diagonal + offset_]; }
+
+	/**
+	 * @brief 在 [xoff, xlim) × [yoff, ylim) 中找一个切分点，两侧都不含公共的开头与结尾
+	 * @details 对角线 k = x - y；前向从 (xoff, yoff) 出发，后向从 (xlim, ylim) 出发，
+	 * 走到同一条对角线上相遇时即为最短编辑路径上的一点
+	 */
+	void split(int xoff, int xlim, int yoff, int ylim, int& xmid, int& ymid)
+	{
+		const int  dmin = xoff - ylim;
+		const int  dmax = xlim - yoff;
+		const int  fmid = xoff - yoff;
+		const int  bmid = xlim - ylim;
+		const bool odd  = ((fmid - bmid) & 1) != 0;
+		int        fmin = fmid;
+		int        fmax = fmid;
+		int        bmin = bmid;
+		int        bmax = bmid;
+		fd(fmid)        = xoff;
+		bd(bmid)        = xlim;
+
+		for (int cost = 1;; ++cost) {
+			// 前向多走一步
+			if (fmin > dmin) {
+				fd(--fmin - 1) = -1;
+			}
+			else {
+				++fmin;
+			}
+			if (fmax < dmax) {
+				fd(++fmax + 1) = -1;
+			}
+			else {
+				--fmax;
+			}
+			for (int d = fmax; d >= fmin; d -= 2) {
+				const int low  = fd(d - 1);
+				const int high = fd(d + 1);
+				int       x    = low >= high ? low + 1 : high;
+				int       y    = x - d;
+				while (x < xlim && y < ylim && a_[x] == b_[y]) {
+					++x;
+					++y;
+				}
+				fd(d) = x;
+				if (odd && bmin <= d && d <= bmax && bd(d) <= x) {
+					xmid = x;
+					ymid = y;
+					return;
+				}
+			}
+
+			// 后向多走一步
+			if (bmin > dmin) {
+				bd(--bmin - 1) = INT_MAX;
+			}
+			else {
+				++bmin;
+			}
+			if (bmax < dmax) {
+				bd(++bmax + 1) = INT_MAX;
+			}
+			else {
+				--bmax;
+			}
+			for (int d = bmax; d >= bmin; d -= 2) {
+				const int low  = bd(d - 1);
+				const int high = bd(d + 1);
+				int       x    = low < high ? low : high - 1;
+				int       y    = x - d;
+				while (xoff < x && yoff < y && a_[x - 1] == b_[y - 1]) {
+					--x;
+					--y;
+				}
+				bd(d) = x;
+				if (!odd && fmin <= d && d <= fmax && x <= fd(d)) {
+					xmid = x;
+					ymid = y;
+					return;
+				}
+			}
+
+			if (cost < too_expensive_) {
+				continue;
+			}
+			// 代价太高：取前向 x + y 最大、后向 x + y 最小的点，哪个离各自的起点更远就用哪个
+			int fxybest = -1;
+			int fxbest  = xoff;
+			for (int d = fmax; d >= fmin; d -= 2) {
+				int x = std::min(fd(d), xlim);
+				int y = x - d;
+				if (ylim < y) {
+					x = ylim + d;
+					y = ylim;
+				}
+				if (fxybest < x + y) {
+					fxybest = x + y;
+					fxbest  = x;
+				}
+			}
+			int bxybest = INT_MAX;
+			int bxbest  = xlim;
+			for (int d = bmax; d >= bmin; d -= 2) {
+				int x = std::max(xoff, bd(d));
+				int y = x - d;
+				if (y < yoff) {
+					x = yoff + d;
+					y = yoff;
+				}
+				if (x + y < bxybest) {
+					bxybest = x + y;
+					bxbest  = x;
+				}
+			}
+			if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+				xmid = fxbest;
+				ymid = fxybest - fxbest;
+			}
+			else {
+				xmid = bxbest;
+				ymid = bxybest - bxbest;
+			}
+			return;
+		}
+	}
+
+	const std::vector<int>& a_;
+	const std::vector<int>& b_;
+	std::vector<int>        fd_;
+	std::vector<int>        bd_;
+	int                     offset_;
+	int                     too_expensive_ = 1;
+};
+
+/**
+ * @brief 标出 a 中被删除、b 中被插入的行
+ * @details 公共的开头与结尾先去掉；只在一侧出现的行一定是改动，不参与 Myers，
+ * 这不影响结果是否最短，却让整段重写的区域几乎不花时间
+ */
+void diff_lines(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b,
+				std::vector<char>& deleted, std::vector<char>& inserted)
+{
+	size_t begin = 0;
+	size_t a_end = a.size();
+	size_t b_end = b.size();
+	while (begin < a_end && begin < b_end && a[begin] == b[begin]) {
+		++begin;
+	}
+	while (begin < a_end && begin < b_end && a[a_end - 1] == b[b_end - 1]) {
+		--a_end;
+		--b_end;
+	}
+	if (begin == a_end || begin == b_end) {
+		std::fill(deleted.begin() + begin, deleted.begin() + a_end, 1);
+		std::fill(inserted.begin() + begin, inserted.begin() + b_end, 1);
+		return;
+	}
+
+	// 行内容编号，并统计每个编号在两侧各出现几次
+	std::unordered_map<std::string_view, int> ids;
+	std::vector<int>                          a_ids(a_end - begin);
+	std::vector<int>                          b_ids(b_end - begin);
+	std::vector<std::pair<int, int>>          counts;
+	auto                                      id_of = [&](std::string_view line) {
+		const auto [it, added] = ids.try_emplace(line, static_cast<int>(counts.size()));
+		if (added) {
+			counts.emplace_back(0, 0);
+		}
+		return it->second;
+	};
+	for (size_t i = begin; i < a_end; ++i) {
+		a_ids[i - begin] = id_of(a[i]);
+		++counts[a_ids[i - begin]].first;
+	}
+	for (size_t i = begin; i < b_end; ++i) {
+		b_ids[i - begin] = id_of(b[i]);
+		++counts[b_ids[i - begin]].second;
+	}
+
+	std::vector<int>    a_kept;
+	std::vector<int>    b_kept;
+	std::vector<size_t> a_index;
+	std::vector<size_t> b_index;
+	for (size_t i = 0; i < a_ids.size(); ++i) {
+		if (counts[a_ids[i]].second == 0) {
+			deleted[begin + i] = 1;
+		}
+		else {
+			a_kept.push_back(a_ids[i]);
+			a_index.push_back(begin + i);
+		}
+	}
+	for (size_t i = 0; i < b_ids.size(); ++i) {
+		if (counts[b_ids[i]].first == 0) {
+			inserted[begin + i] = 1;
+		}
+		else {
+			b_kept.push_back(b_ids[i]);
+			b_index.push_back(begin + i);
+		}
+	}
+
+	std::vector<char> kept_deleted(a_kept.size(), 0);
+	std::vector<char> kept_inserted(b_kept.size(), 0);
+	Myers(a_kept, b_kept).Compare(kept_deleted, kept_inserted);
+	for (size_t i = 0; i < a_kept.size(); ++i) {
+		deleted[a_index[i]] = kept_deleted[i];
+	}
+	for (size_t i = 0; i < b_kept.size(); ++i) {
+		inserted[b_index[i]] = kept_inserted[i];
+	}
+}
+
+struct change_t
+{
+	size_t a_begin;
+	size_t a_end;
+	size_t b_begin;
+	size_t b_end;
+};
+
+void append_line(std::string& out, char prefix, std::string_view line)
+{
+	out += prefix;
+	out.append(line.data(), line.size());
+	if (line.empty() || line.back() != '\n') {
+		out += "\n\\ No newline at end of file\n";
+	}
+}
+
+// unified diff 的区间：长度为 1 时省略长度，长度为 0 时起点是前一行
+std::string hunk_range(size_t begin, size_t length)
+{
+	if (length == 1) {
+		return std::to_string(begin + 1);
+	}
+	return std::to_string(length == 0 ? begin : begin + 1) + "," + std::to_string(length);
+}
+}   // namespace
+
+void UnifiedDiff(std::string_view before, std::string_view after, const std::string& path,
+				 std::string& out, size_t context)
+{
+	if (before == after) {
+		return;
+	}
+	const auto        a = split_lines(before);
+	const auto        b = split_lines(after);
+	std::vector<char> deleted(a.size(), 0);
+	std::vector<char> inserted(b.size(), 0);
+	diff_lines(a, b, deleted, inserted);
+
+	std::vector<change_t> changes;
+	for (size_t i = 0, j = 0; i < a.size() || j < b.size();) {
+		if ((i < a.size() && deleted[i]) || (j < b.size() && inserted[j])) {
+			change_t change{i, i, j, j};
+			while (i < a.size() && deleted[i]) {
+				++i;
+			}
+			while (j < b.size() && inserted[j]) {
+				++j;
+			}
+			change.a_end = i;
+			change.b_end = j;
+			changes.push_back(change);
+		}
+		else {
+			++i;
+			++j;
+		}
+	}
+
+	out += "--- a/" + path + "\n+++ b/" + path + "\n";
+	for (size_t first = 0; first < changes.size();) {
+		// 两处改动之间的相同行不超过 2 * context 时并入同一个 hunk
+		size_t last = first;
+		while (last + 1 < changes.size() &&
+			   changes[last + 1].a_begin - changes[last].a_end <= 2 * context) {
+			++last;
+		}
+		const size_t leading  = std::min(context, changes[first].a_begin);
+		const size_t trailing = std::min(context, a.size() - changes[last].a_end);
+		const size_t a_begin  = changes[first].a_begin - leading;
+		const size_t b_begin  = changes[first].b_begin - leading;
+		const size_t a_end    = changes[last].a_end + trailing;
+		const size_t b_end    = changes[last].b_end + trailing;
+		out += "@@ -" + hunk_range(a_begin, a_end - a_begin) + " +" +
+			   hunk_range(b_begin, b_end - b_begin) + " @@\n";
+
+		size_t i = a_begin;
+		for (size_t k = first; k <= last; ++k) {
+			for (; i < changes[k].a_begin; ++i) {
+				append_line(out, ' ', a[i]);
+			}
+			for (; i < changes[k].a_end; ++i) {
+				append_line(out, '-', a[i]);
+			}
+			for (size_t j = changes[k].b_begin; j < changes[k].b_end; ++j) {
+				append_line(out, '+', b[j]);
+			}
+		}
+		for (; i < a_end; ++i) {
+			append_line(out, ' ', a[i]);
+		}
+		first = last + 1;
+	}
+}
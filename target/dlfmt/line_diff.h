@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 按行比较 before 与 after，以 unified diff 格式追加到 out，内容相同时不追加任何内容
+ * @details 先去掉公共的开头与结尾（格式化通常只改动少数几处），中间部分用线性空间的 Myers 算法。
+ * 编辑距离超过约 sqrt(行数) 时改用启发式的切分点，结果仍是正确的 diff，但不保证最短，
+ * 因此整篇重写的大文件也不会退化成平方复杂度。
+ *
+ * @param path 写在 `--- a/path`、`+++ b/path` 中的路径
+ * @param context 每段改动前后保留的上下文行数
+ */
+void UnifiedDiff(std::string_view before, std::string_view after, const std::string& path,
+				 std::string& out, size_t context = 3);
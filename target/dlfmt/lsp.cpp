@@ -0,0 +1,599 @@
+#include "lsp.h"
+#include "dl/ast_walker.h"
+#include "dl/document.h"
+#include "dl/formatter.h"
+#include "dl/parser.h"
+#include "dl/tokenizer.h"
+#include "dlfmt_core.h"
+#include "rpc_channel.h"
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+using namespace dl;
+
+namespace {
+constexpr int LSP_REQUEST_FAILED = -32803;
+
+// LSP 的 SymbolKind
+constexpr int SYMBOL_METHOD   = 6;
+constexpr int SYMBOL_FUNCTION = 12;
+constexpr int SYMBOL_VARIABLE = 13;
+
+/**
+ * @brief 行首偏移表，负责 LSP 位置（行, 列）与字节偏移的互换
+ * @details 列按协商的编码计：utf-16 时四字节的 UTF-8 字符算两个单位，utf-8 时直接是字节数
+ */
+class LineIndex
+{
+public:
+	LineIndex(std::string_view text, bool utf16)
+		: text_(text)
+		, utf16_(utf16)
+	{
+		starts_.push_back(0);
+		for (size_t i = 0; i < text.size(); ++i) {
+			if (text[i] == '\n') {
+				starts_.push_back(i + 1);
+			}
+		}
+	}
+
+	size_t LineStart(size_t line) const noexcept
+	{
+		return line < starts_.size() ? starts_[line] : text_.size();
+	}
+
+	size_t LineOf(size_t offset) const noexcept
+	{
+		return static_cast<size_t>(std::upper_bound(starts_.begin(), starts_.end(), offset) -
+								   starts_.begin()) -
+			   1;
+	}
+
+	// 超出范围的位置截到行尾或文末
+	size_t Offset(const json& position) const
+	{
+		const size_t line = position.at("line").get<size_t>();
+		if (line >= starts_.size()) {
+			return text_.size();
+		}
+		size_t       offset   = starts_[line];
+		const size_t line_end = line + 1 < starts_.size() ? starts_[line + 1] - 1 : text_.size();
+		size_t       column   = position.at("character").get<size_t>();
+		while (column > 0 && offset < line_end) {
+			const size_t length = CharLength(static_cast<unsigned char>(text_[offset]));
+			const size_t units  = utf16_ ? (length == 4 ? 2 : 1) : length;
+			if (units > column) {
+				break;
+			}
+			column -= units;
+			offset = std::min(offset + length, line_end);
+		}
+		return offset;
+	}
+
+	json Position(size_t offset) const
+	{
+		offset            = std::min(offset, text_.size());
+		const size_t line = LineOf(offset);
+		size_t       column = 0;
+		for (size_t i = starts_[line]; i < offset;) {
+			const size_t length = CharLength(static_cast<unsigned char>(text_[i]));
+			column += utf16_ ? (length == 4 ? 2 : 1) : length;
+			i += length;
+		}
+		return {{"line", line}, {"character", column}};
+	}
+
+	json Range(size_t begin, size_t end) const
+	{
+		return {{"start", Position(begin)}, {"end", Position(end)}};
+	}
+
+private:
+	static size_t CharLength(unsigned char lead) noexcept
+	{
+		if (lead < 0x80) {
+			return 1;
+		}
+		if ((lead >> 5) == 0x6) {
+			return 2;
+		}
+		if ((lead >> 4) == 0xE) {
+			return 3;
+		}
+		if ((lead >> 3) == 0x1E) {
+			return 4;
+		}
+		// 非法字节按单字节处理
+		return 1;
+	}
+
+	std::string_view    text_;
+	std::vector<size_t> starts_;
+	bool                utf16_;
+};
+
+/**
+ * @brief 分词并解析一份文档，记录每条顶层语句的字节区间
+ *
+ */
+class ParsedDocument
+{
+public:
+	ParsedDocument(const std::string& text, const std::string& name)
+		: tokenizer_(std::string(text), name)
+		, parser_(tokenizer_.getTokens(), name)
+	{
+		const auto& tokens = tokenizer_.getTokens();
+		statements_        = parser_.GetAstRoot()->stat_list_.statement_list_;
+		const auto& stats  = *statements_;
+		// 一条顶层语句从它的首个 token 开始，到下一条语句首个 token 之前的 token 结束
+		for (size_t i = 0; i < stats.size(); ++i) {
+			const Token* last =
+				i + 1 < stats.size() ? stats[i + 1]->first_token_ - 1 : &tokens.back();
+			spans_.push_back({Begin(stats[i]->first_token_), End(last)});
+		}
+	}
+
+	const std::vector<AstNode*>& Statements() const noexcept { return *statements_; }
+	const std::vector<std::pair<size_t, size_t>>& Spans() const noexcept { return spans_; }
+	const std::vector<CommentToken>& Comments() noexcept { return tokenizer_.getCommentTokens(); }
+
+	size_t Begin(std::string_view source) const noexcept
+	{
+		return static_cast<size_t>(source.data() - tokenizer_.getText().data());
+	}
+	size_t Begin(const Token* token) const noexcept { return Begin(token->source_); }
+	size_t End(const Token* token) const noexcept { return Begin(token) + token->source_.size(); }
+
+private:
+	Tokenizer<TokenizeMode::FormatAuto>    tokenizer_;
+	Parser                                 parser_;
+	std::vector<AstNode*>*                 statements_;
+	std::vector<std::pair<size_t, size_t>> spans_;
+};
+
+class LanguageServer
+{
+public:
+	LanguageServer()
+		: channel_(stdin, stdout)
+	{}
+
+	int Run()
+	{
+		std::string body;
+		while (channel_.Read(body)) {
+			const json message = json::parse(body, nullptr, false);
+			if (message.is_discarded() || !message.is_object()) {
+				channel_.ReplyError(json(), RPC_PARSE_ERROR, "Parse error");
+				continue;
+			}
+			// 没有 method 的是客户端发回的响应；method 不是字符串时，请求回复错误，通知直接忽略
+			if (message.contains("method") && !message["method"].is_string()) {
+				if (message.contains("id")) {
+					channel_.ReplyError(message["id"],
+										RPC_INVALID_REQUEST,
+										"Invalid request: method must be a string");
+				}
+				continue;
+			}
+			const std::string method = message.value("method", std::string());
+			if (method == "exit") {
+				return shutdown_ ? 0 : 1;
+			}
+			Dispatch(method, message);
+		}
+		return shutdown_ ? 0 : 1;
+	}
+
+private:
+	void Dispatch(const std::string& method, const json& message)
+	{
+		// 没有 id 的是通知，不回复
+		const bool  is_request = message.contains("id");
+		const json  id         = is_request ? message["id"] : json();
+		const json& params     = message.contains("params") ? message["params"] : empty_params_;
+		try {
+			json result;
+			if (method == "initialize") {
+				result = Initialize(params);
+			}
+			else if (method == "shutdown") {
+				shutdown_ = true;
+			}
+			else if (method == "textDocument/didOpen") {
+				const auto& document = params.at("textDocument");
+				auto&       open     = documents_[document.at("uri").get<std::string>()];
+				open.text            = document.at("text").get<std::string>();
+				open.parsed.reset();
+			}
+			else if (method == "textDocument/didChange") {
+				DidChange(params);
+			}
+			else if (method == "textDocument/didClose") {
+				documents_.erase(params.at("textDocument").at("uri").get<std::string>());
+			}
+			else if (method == "workspace/didChangeConfiguration") {
+				const auto& settings = params.value("settings", json::object());
+				if (settings.contains("dlfmt")) {
+					SetMode(settings["dlfmt"].value("format", json::object()).value("mode", ""));
+				}
+			}
+			else if (method == "textDocument/formatting") {
+				result = Formatting(params);
+			}
+			else if (method == "textDocument/rangeFormatting") {
+				result = RangeFormatting(params);
+			}
+			else if (method == "textDocument/onTypeFormatting") {
+				result = OnTypeFormatting(params);
+			}
+			else if (method == "textDocument/documentSymbol") {
+				result = DocumentSymbol(params);
+			}
+			else if (method == "textDocument/foldingRange") {
+				result = FoldingRange(params);
+			}
+			else if (is_request) {
+				channel_.ReplyError(id, RPC_METHOD_NOT_FOUND, "Method not found: " + method);
+				return;
+			}
+			if (is_request) {
+				channel_.Reply(id, std::move(result));
+			}
+		}
+		catch (const json::exception& e) {
+			if (is_request) {
+				channel_.ReplyError(id, RPC_INVALID_PARAMS, e.what());
+			}
+		}
+		catch (const std::exception& e) {
+			if (is_request) {
+				channel_.ReplyError(id, LSP_REQUEST_FAILED, e.what());
+			}
+		}
+	}
+
+	json Initialize(const json& params)
+	{
+		// 客户端支持时用 utf-8 计列，省去 utf-16 换算
+		utf16_ = true;
+		if (params.contains("capabilities")) {
+			const auto& general = params["capabilities"].value("general", json::object());
+			for (const auto& encoding : general.value("positionEncodings", json::array())) {
+				if (encoding == "utf-8") {
+					utf16_ = false;
+				}
+			}
+		}
+		if (params.contains("initializationOptions") && params["initializationOptions"].is_object()) {
+			SetMode(params["initializationOptions"].value("mode", ""));
+		}
+		return {{"capabilities",
+				 {{"positionEncoding", utf16_ ? "utf-16" : "utf-8"},
+				  {"textDocumentSync", 2},
+				  {"documentFormattingProvider", true},
+				  {"documentRangeFormattingProvider", true},
+				  {"documentOnTypeFormattingProvider", {{"firstTriggerCharacter", "\n"}}},
+				  {"documentSymbolProvider", true},
+				  {"foldingRangeProvider", true}}},
+				{"serverInfo", {{"name", "dlfmt"}}}};
+	}
+
+	void SetMode(const std::string& mode)
+	{
+		if (mode == "manual") {
+			param_ = dlfmt_param::manual_format;
+		}
+		else if (mode == "auto") {
+			param_ = dlfmt_param::auto_format;
+		}
+	}
+
+	// 增量同步：编辑同时交给已建立的分段解析结果，下次格式化只重新解析受影响的顶层语句
+	void DidChange(const json& params)
+	{
+		auto& document = Open(params);
+		auto& text     = document.text;
+		for (const auto& change : params.at("contentChanges")) {
+			const std::string new_text = change.at("text").get<std::string>();
+			if (change.contains("range")) {
+				const LineIndex index(text, utf16_);
+				const size_t    begin = index.Offset(change["range"].at("start"));
+				const size_t    end   = std::max(begin, index.Offset(change["range"].at("end")));
+				text.replace(begin, end - begin, new_text);
+				if (document.parsed) {
+					document.parsed->Edit(begin, end - begin, new_text);
+				}
+			}
+			else {
+				text = new_text;
+				document.parsed.reset();
+			}
+		}
+	}
+
+	struct OpenDocument
+	{
+		std::string text;
+		// 第一次整篇格式化时建立，模式改变时重建
+		std::unique_ptr<dl::Document> parsed;
+		dlfmt_param                   parsed_param = dlfmt_param::auto_format;
+	};
+
+	OpenDocument& Open(const json& params)
+	{
+		const auto uri = params.at("textDocument").at("uri").get<std::string>();
+		const auto it  = documents_.find(uri);
+		if (it == documents_.end()) {
+			throw std::runtime_error("Unknown document: " + uri);
+		}
+		return it->second;
+	}
+
+	std::string& Document(const json& params) { return Open(params).text; }
+
+	FormatOptions Options(const json& params) const
+	{
+		FormatOptions options;
+		options.mode = param_ == dlfmt_param::manual_format ? FormatMode::Manual : FormatMode::Auto;
+		options.name = DocumentName(params);
+		return options;
+	}
+
+	static std::string DocumentName(const json& params)
+	{
+		std::string uri = params.at("textDocument").at("uri").get<std::string>();
+		if (uri.compare(0, 7, "file://") == 0) {
+			uri.erase(0, 7);
+		}
+		return uri;
+	}
+
+	json Formatting(const json& params)
+	{
+		auto&       document = Open(params);
+		const auto& text     = document.text;
+		if (!document.parsed || document.parsed_param != param_) {
+			document.parsed       = std::make_unique<dl::Document>(text, Options(params));
+			document.parsed_param = param_;
+		}
+		std::string output;
+		document.parsed->Format(output);
+		if (output == text) {
+			return json::array();
+		}
+		const LineIndex index(text, utf16_);
+		return json::array({{{"range", index.Range(0, text.size())}, {"newText", output}}});
+	}
+
+	// 只重新打印与 [begin, end) 相交的最内层语句，见 Formatter::FormatRange
+	json FormatStatements(const json& params, size_t begin, size_t end)
+	{
+		const auto&    text = Document(params);
+		const TextEdit edit = Formatter::FormatRange(text, begin, end, Options(params));
+		if (text.compare(edit.offset, edit.length, edit.text) == 0) {
+			return json::array();
+		}
+		const LineIndex index(text, utf16_);
+		return json::array(
+			{{{"range", index.Range(edit.offset, edit.offset + edit.length)}, {"newText", edit.text}}});
+	}
+
+	json RangeFormatting(const json& params)
+	{
+		const auto&     text = Document(params);
+		const LineIndex index(text, utf16_);
+		const auto&     range = params.at("range");
+		return FormatStatements(params, index.Offset(range.at("start")), index.Offset(range.at("end")));
+	}
+
+	json OnTypeFormatting(const json& params)
+	{
+		const auto&  text = Document(params);
+		const size_t line = params.at("position").at("line").get<size_t>();
+		if (line == 0) {
+			return json::array();
+		}
+		const LineIndex index(text, utf16_);
+		const size_t    begin = index.LineStart(line - 1);
+		// 正在输入的代码往往还不完整，解析失败时静默不处理
+		try {
+			return FormatStatements(params, begin, index.LineStart(line) - 1);
+		}
+		catch (const SyntaxError&) {
+			return json::array();
+		}
+	}
+
+	json DocumentSymbol(const json& params)
+	{
+		const auto&     text = Document(params);
+		ParsedDocument  document(text, DocumentName(params));
+		const LineIndex index(text, utf16_);
+
+		json        symbols = json::array();
+		const auto& stats   = document.Statements();
+		for (size_t i = 0; i < stats.size(); ++i) {
+			const AstNode* stat = stats[i];
+			if (stat->type_ == AstNodeType::LocalVarStat) {
+				const auto [begin, end] = document.Spans()[i];
+				for (const Token* var : *stat->local_var_stat_.var_list_) {
+					symbols.push_back(
+						{{"name", var->source_},
+						 {"kind", SYMBOL_VARIABLE},
+						 {"range", index.Range(begin, end)},
+						 {"selectionRange", index.Range(document.Begin(var), document.End(var))}});
+				}
+			}
+			CollectFunctions(document, index, stat, symbols);
+		}
+		return symbols;
+	}
+
+	// 收集 node 内（含自身）的函数定义，嵌套的函数作为 children
+	void CollectFunctions(const ParsedDocument& document, const LineIndex& index,
+						  const AstNode* node, json& symbols)
+	{
+		const AstNode* function = nullptr;
+		std::string    name;
+		int            kind       = SYMBOL_FUNCTION;
+		size_t         begin      = 0;
+		size_t         name_begin = 0;
+		size_t         name_end   = 0;
+		size_t         end        = 0;
+
+		if (node->type_ == AstNodeType::FunctionStat ||
+			node->type_ == AstNodeType::LocalFunctionStat) {
+			function = node->type_ == AstNodeType::FunctionStat
+						   ? node
+						   : node->local_function_stat_.function_stat_;
+			const auto& stat  = function->function_stat_;
+			const auto& chain = *stat.name_chain_;
+			for (size_t i = 0; i < chain.size(); ++i) {
+				if (i) {
+					name += stat.is_method_ && i + 1 == chain.size() ? ':' : '.';
+				}
+				name += chain[i]->source_;
+			}
+			kind       = stat.is_method_ ? SYMBOL_METHOD : SYMBOL_FUNCTION;
+			begin      = document.Begin(node->first_token_);
+			name_begin = document.Begin(chain.front());
+			name_end   = document.End(chain.back());
+			end        = document.End(stat.end_token_);
+		}
+		else if (node->type_ == AstNodeType::AssignmentStat &&
+				 node->assignment_stat_.lhs_->size() == 1 &&
+				 node->assignment_stat_.rhs_->size() == 1 &&
+				 node->assignment_stat_.rhs_->front()->type_ == AstNodeType::FunctionLiteral) {
+			// M.foo = function() end：名字取 = 之前的源码
+			function        = node->assignment_stat_.rhs_->front();
+			const Token* eq = function->first_token_ - 1;
+			begin           = document.Begin(node->first_token_);
+			name_begin      = begin;
+			name_end        = document.End(eq - 1);
+			end             = document.End(function->function_literal_.end_token_);
+		}
+
+		if (!function) {
+			for_each_child(node, [&](const AstNode* child) {
+				CollectFunctions(document, index, child, symbols);
+			});
+			return;
+		}
+
+		if (name.empty()) {
+			name = std::string(node->first_token_->source_.data(), name_end - name_begin);
+		}
+		json children = json::array();
+		for_each_child(function, [&](const AstNode* child) {
+			CollectFunctions(document, index, child, children);
+		});
+		json symbol = {{"name", name},
+					   {"kind", kind},
+					   {"range", index.Range(begin, end)},
+					   {"selectionRange", index.Range(name_begin, name_end)}};
+		if (!children.empty()) {
+			symbol["children"] = std::move(children);
+		}
+		symbols.push_back(std::move(symbol));
+	}
+
+	json FoldingRange(const json& params)
+	{
+		const auto&     text = Document(params);
+		ParsedDocument  document(text, DocumentName(params));
+		const LineIndex index(text, utf16_);
+
+		json ranges = json::array();
+		// 行号统一由字节偏移换算（从 0 开始）
+		const auto add = [&ranges](size_t start_line, size_t end_line, const char* kind) {
+			if (end_line > start_line) {
+				json range = {{"startLine", start_line}, {"endLine", end_line}};
+				if (kind) {
+					range["kind"] = kind;
+				}
+				ranges.push_back(std::move(range));
+			}
+		};
+
+		// 代码块折叠到结束 token 的上一行，让 end / } / until 保持可见
+		std::function<void(const AstNode*)> visit = [&](const AstNode* node) {
+			const Token* end = nullptr;
+			switch (node->type_) {
+			case AstNodeType::FunctionLiteral: end = node->function_literal_.end_token_; break;
+			case AstNodeType::FunctionStat: end = node->function_stat_.end_token_; break;
+			case AstNodeType::TableLiteral: end = node->table_literal_.end_token_; break;
+			case AstNodeType::IfStat: end = node->if_stat_.end_token_; break;
+			case AstNodeType::DoStat: end = node->do_stat_.end_token_; break;
+			case AstNodeType::WhileStat: end = node->while_stat_.end_token_; break;
+			case AstNodeType::NumericForStat: end = node->numeric_for_stat_.end_token_; break;
+			case AstNodeType::GenericForStat: end = node->generic_for_stat_.end_token_; break;
+			case AstNodeType::RepeatStat: end = node->repeat_stat_.until_token_; break;
+			default: break;
+			}
+			if (end) {
+				const size_t end_line = index.LineOf(document.Begin(end));
+				if (end_line > 0) {
+					add(index.LineOf(document.Begin(node->first_token_)), end_line - 1, nullptr);
+				}
+			}
+			for_each_child(node, visit);
+		};
+		for (const AstNode* stat : document.Statements()) {
+			visit(stat);
+		}
+
+		// 多行长注释单独折叠，逐行相连的短注释合并折叠
+		size_t run_start = 0;
+		size_t run_end   = 0;
+		bool   in_run    = false;
+		for (const auto& comment : document.Comments()) {
+			const size_t begin      = document.Begin(comment.source_);
+			const size_t start_line = index.LineOf(begin);
+			if (comment.type_ == CommentTokenType::LongComment) {
+				add(start_line, index.LineOf(begin + comment.source_.size()), "comment");
+				continue;
+			}
+			if (comment.type_ != CommentTokenType::ShortComment) {
+				continue;
+			}
+			if (in_run && start_line == run_end + 1) {
+				run_end = start_line;
+				continue;
+			}
+			if (in_run) {
+				add(run_start, run_end, "comment");
+			}
+			run_start = run_end = start_line;
+			in_run              = true;
+		}
+		if (in_run) {
+			add(run_start, run_end, "comment");
+		}
+		return ranges;
+	}
+
+	RpcChannel                                    channel_;
+	std::unordered_map<std::string, OpenDocument> documents_;
+	dlfmt_param                                   param_        = dlfmt_param::auto_format;
+	bool                                          utf16_        = true;
+	bool                                          shutdown_     = false;
+	const json                                    empty_params_ = json::object();
+};
+}   // namespace
+
+int RunLanguageServer()
+{
+	LanguageServer server;
+	return server.Run();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * @brief Language Server Protocol 模式，通过 stdin/stdout 与编辑器通信
+ * @details 文档只保存在内存里，格式化结果以 TextEdit 返回，不读写磁盘。支持：
+ * - textDocument/formatting：整篇格式化，编辑以增量方式同步，只重新解析受影响的顶层语句；
+ * - textDocument/rangeFormatting：只重新打印与选区相交的最内层语句；
+ * - textDocument/onTypeFormatting：换行后格式化上一行所在的语句；
+ * - textDocument/documentSymbol：函数、方法与文件级局部变量；
+ * - textDocument/foldingRange：代码块、多行表与注释。
+ * 格式化模式取 initializationOptions.mode 或配置 dlfmt.format.mode，默认 auto。
+ *
+ * @return int 进程退出码
+ */
+int RunLanguageServer();
@@ -1,6 +1,87 @@
 #include "dl/timer.h"
 #include "dlfmt_core.h"
+#include "git_changes.h"
+#include "lsp.h"
+#include "result_cache.h"
+#include "run_stats.h"
+#include "server.h"
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
 #include <spdlog/spdlog.h>
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+// 解析 512M、2GiB、1048576 这样的大小，格式错误或溢出时返回 0
+static size_t ParseByteSize(const std::string& text)
+{
+	const char* const first = text.data();
+	const char* const last  = first + text.size();
+	size_t            value = 0;
+	// from_chars 不接受前导空白与正负号，无符号数遇到 '-' 也直接失败
+	const auto [ptr, ec] = std::from_chars(first, last, value);
+	if (ec != std::errc()) {
+		return 0;
+	}
+	const std::string unit(ptr, last);
+	unsigned          shift = 0;
+	if (unit.empty() || unit == "B") {
+		shift = 0;
+	}
+	else if (unit == "K" || unit == "KB" || unit == "KiB") {
+		shift = 10;
+	}
+	else if (unit == "M" || unit == "MB" || unit == "MiB") {
+		shift = 20;
+	}
+	else if (unit == "G" || unit == "GB" || unit == "GiB") {
+		shift = 30;
+	}
+	else {
+		return 0;
+	}
+	if (value > (SIZE_MAX >> shift)) {
+		return 0;
+	}
+	return value << shift;
+}
+
+// 解析 --shard 的 i/N，i 从 1 开始
+static bool ParseShard(const std::string& text, dlfmt_options& options)
+{
+	const size_t slash = text.find('/');
+	if (slash == std::string::npos) {
+		return false;
+	}
+	// 只接受完整的十进制数字，-3 这样的负数与溢出都算格式错误
+	const auto parse = [](const char* first, const char* last, size_t& value) {
+		const auto [ptr, ec] = std::from_chars(first, last, value);
+		return first != last && ec == std::errc() && ptr == last;
+	};
+	size_t index = 0;
+	size_t count = 0;
+	if (!parse(text.data(), text.data() + slash, index) ||
+		!parse(text.data() + slash + 1, text.data() + text.size(), count)) {
+		return false;
+	}
+	if (count == 0 || index == 0 || index > count) {
+		return false;
+	}
+	options.shard_index = index - 1;
+	options.shard_count = count;
+	return true;
+}
+
+// stdout 要留给结果或协议消息时，日志改写到 stderr
+static void UseStderrLogger()
+{
+	const auto error_console = spdlog::stderr_color_mt("error_console");
+	error_console->set_pattern("[%^%l %s:%#%$] %v");
+	spdlog::set_default_logger(error_console);
+}
 
 int main(int argc, char* argv[])
 {
@@ -8,8 +89,21 @@ int main(int argc, char* argv[])
 	console->set_pattern("[%^%l %s:%#%$] %v");
 	spdlog::set_default_logger(console);
 	dlfmt_mode  work_mode  = dlfmt_mode::show_help;
-	dlfmt_param work_param = dlfmt_param::auto_format;
-	std::string file_or_directory;
+	dlfmt_param   work_param = dlfmt_param::auto_format;
+	dlfmt_options work_options;
+	std::string   file_or_directory;
+	bool          use_stdin  = false;
+	bool          use_stdout = false;
+	bool          use_range  = false;
+	bool          use_check  = false;
+	bool          use_diff   = false;
+	bool          use_stats  = false;
+	bool          stats_json = false;
+	std::string   changed_since;
+	dlfmt_range   work_range;
+	if (const char* cache_dir = std::getenv("DLFMT_CACHE_DIR")) {
+		work_options.result_cache_dir = cache_dir;
+	}
 	for (int i = 1; i < argc; ++i) {
 		std::string arg = argv[i];
 		if (arg == "--help") {
@@ -68,6 +162,83 @@ int main(int argc, char* argv[])
 				return 1;
 			}
 		}
+		else if (arg == "--files-from") {
+			if (i + 1 < argc) {
+				file_or_directory = argv[++i];
+				work_mode         = dlfmt_mode::files_from;
+			}
+			else {
+				SPDLOG_ERROR("No file list specified after --files-from");
+				return 1;
+			}
+		}
+		else if (arg == "--watch") {
+			if (i + 1 < argc) {
+				file_or_directory = argv[++i];
+				work_mode         = dlfmt_mode::watch;
+			}
+			else {
+				SPDLOG_ERROR("No directory or json task specified after --watch");
+				return 1;
+			}
+		}
+		else if (arg == "--check-syntax") {
+			if (i + 1 < argc) {
+				file_or_directory = argv[++i];
+				work_mode         = dlfmt_mode::check_syntax;
+			}
+			else {
+				SPDLOG_ERROR("No file or directory specified after --check-syntax");
+				return 1;
+			}
+		}
+		else if (arg == "--server") {
+			work_mode = dlfmt_mode::server;
+		}
+		else if (arg == "--lsp") {
+			work_mode = dlfmt_mode::lsp;
+		}
+		else if (arg == "--stdin") {
+			use_stdin = true;
+		}
+		else if (arg == "--stdout") {
+			use_stdout = true;
+		}
+		else if (arg == "--check") {
+			use_check = true;
+		}
+		else if (arg == "--diff") {
+			use_diff = true;
+		}
+		else if (arg == "--stats" || arg == "--stats=json") {
+			use_stats  = true;
+			stats_json = arg == "--stats=json";
+		}
+		else if (arg == "--verify") {
+			work_options.verify = true;
+		}
+		else if (arg == "--changed-since") {
+			if (i + 1 < argc) {
+				changed_since = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No git revision specified after --changed-since");
+				return 1;
+			}
+		}
+		else if (arg == "--range") {
+			if (i + 1 < argc) {
+				if (!ParseRange(argv[++i], work_range)) {
+					SPDLOG_ERROR("Invalid range: {}", argv[i]);
+					return 1;
+				}
+				use_range = true;
+			}
+			else {
+				SPDLOG_ERROR("No range specified after --range");
+				return 1;
+			}
+		}
 		else if (arg == "--param") {
 			if (i + 1 < argc) {
 				std::string param = argv[++i];
@@ -83,8 +254,102 @@ int main(int argc, char* argv[])
 				}
 			}
 		}
+		else if (arg == "--output-dir") {
+			if (i + 1 < argc) {
+				work_options.output_dir = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No directory specified after --output-dir");
+				return 1;
+			}
+		}
+		else if (arg == "--link-dest") {
+			if (i + 1 < argc) {
+				work_options.link_dest = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No directory specified after --link-dest");
+				return 1;
+			}
+		}
+		else if (arg == "--depfile") {
+			if (i + 1 < argc) {
+				work_options.depfile = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No file specified after --depfile");
+				return 1;
+			}
+		}
+		else if (arg == "--stamp") {
+			if (i + 1 < argc) {
+				work_options.stamp = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No file specified after --stamp");
+				return 1;
+			}
+		}
+		else if (arg == "--shard") {
+			if (i + 1 < argc) {
+				if (!ParseShard(argv[++i], work_options)) {
+					SPDLOG_ERROR("Invalid shard: {}, expected i/N with 1 <= i <= N", argv[i]);
+					return 1;
+				}
+			}
+			else {
+				SPDLOG_ERROR("No shard specified after --shard");
+				return 1;
+			}
+		}
+		else if (arg == "--max-memory") {
+			if (i + 1 < argc) {
+				work_options.max_memory = ParseByteSize(argv[++i]);
+				if (work_options.max_memory == 0) {
+					SPDLOG_ERROR("Invalid memory size: {}", argv[i]);
+					return 1;
+				}
+			}
+			else {
+				SPDLOG_ERROR("No size specified after --max-memory");
+				return 1;
+			}
+		}
+		else if (arg == "--result-cache") {
+			if (i + 1 < argc) {
+				work_options.result_cache_dir = argv[++i];
+			}
+			else {
+				SPDLOG_ERROR("No directory specified after --result-cache");
+				return 1;
+			}
+		}
+		else if (arg == "--result-cache-size") {
+			if (i + 1 < argc) {
+				work_options.result_cache_size = ParseByteSize(argv[++i]);
+				if (work_options.result_cache_size == 0) {
+					SPDLOG_ERROR("Invalid cache size: {}", argv[i]);
+					return 1;
+				}
+			}
+			else {
+				SPDLOG_ERROR("No size specified after --result-cache-size");
+				return 1;
+			}
+		}
 	}
 
+    // --changed-since 可以单独使用，此时格式化当前目录下的改动文件
+    if (!changed_since.empty() && work_mode == dlfmt_mode::show_help) {
+        work_mode         = dlfmt_mode::format_directory;
+        file_or_directory = ".";
+    }
+
+    // --stdin 可以不带 --format-file，此时默认格式化
+    if (use_stdin && work_mode == dlfmt_mode::show_help) {
+        work_mode = dlfmt_mode::format_file;
+    }
+
     if(work_mode == dlfmt_mode::show_help){
         ShowHelp();
         return 0;
@@ -95,39 +360,265 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (use_stats && (work_mode == dlfmt_mode::server || work_mode == dlfmt_mode::lsp ||
+                      work_mode == dlfmt_mode::check_syntax)) {
+        SPDLOG_ERROR("--stats does not work with --server, --lsp or --check-syntax");
+        return 1;
+    }
+
+    if(work_mode == dlfmt_mode::server || work_mode == dlfmt_mode::lsp){
+        UseStderrLogger();
+        return work_mode == dlfmt_mode::server ? RunServer() : RunLanguageServer();
+    }
+
+    if (work_mode == dlfmt_mode::check_syntax) {
+        // stdout 只留给错误列表
+        UseStderrLogger();
+        try {
+            const std::vector<std::string> errors = CheckSyntax(file_or_directory);
+            for (const auto& error : errors) {
+                std::cout << error << '\n';
+            }
+            std::cout.flush();
+            return errors.empty() ? 0 : 1;
+        }
+        catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return 1;
+        }
+    }
+
+    if (!changed_since.empty()) {
+        if (work_mode != dlfmt_mode::format_directory &&
+            work_mode != dlfmt_mode::compress_directory && work_mode != dlfmt_mode::json_task) {
+            SPDLOG_ERROR("--changed-since only works with --format-directory, --compress-directory or --json-task");
+            return 1;
+        }
+        try {
+            work_options.changed_files = GitChangedFiles(changed_since);
+        }
+        catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return 1;
+        }
+    }
+
+    if (!work_options.link_dest.empty() && work_options.output_dir.empty()) {
+        SPDLOG_ERROR("--link-dest only works with --output-dir");
+        return 1;
+    }
+    if (!work_options.output_dir.empty() &&
+        ((work_mode != dlfmt_mode::format_directory && work_mode != dlfmt_mode::compress_directory) ||
+         use_check || use_diff)) {
+        SPDLOG_ERROR("--output-dir only works with --format-directory or --compress-directory");
+        return 1;
+    }
+    if (!work_options.depfile.empty() || !work_options.stamp.empty()) {
+        if (work_mode != dlfmt_mode::json_task || use_check || use_diff ||
+            !changed_since.empty() || work_options.shard_count > 1) {
+            SPDLOG_ERROR("--depfile/--stamp only work with a full --json-task run");
+            return 1;
+        }
+        if (!work_options.depfile.empty() && work_options.stamp.empty()) {
+            SPDLOG_ERROR("--depfile needs --stamp as its target");
+            return 1;
+        }
+    }
+    if (work_options.shard_count > 1 && work_mode != dlfmt_mode::format_directory &&
+        work_mode != dlfmt_mode::compress_directory && work_mode != dlfmt_mode::json_task &&
+        work_mode != dlfmt_mode::files_from) {
+        SPDLOG_ERROR("--shard only works with --format-directory, --compress-directory, --json-task or --files-from");
+        return 1;
+    }
+
+    // --files-from - 从标准输入读的是文件清单，不是源码
+    if (file_or_directory == "-" && work_mode != dlfmt_mode::files_from) {
+        use_stdin = true;
+    }
+    if (use_range && work_mode != dlfmt_mode::format_file) {
+        SPDLOG_ERROR("--range only works with --format-file");
+        return 1;
+    }
+    std::unique_ptr<RunStats> stats;
+    if (use_stats) {
+        if (use_stdin || use_stdout || use_range || work_mode == dlfmt_mode::watch) {
+            SPDLOG_ERROR("--stats does not work with --stdin, --stdout, --range or --watch");
+            return 1;
+        }
+        stats              = std::make_unique<RunStats>();
+        work_options.stats = stats.get();
+    }
+
+    if (use_check || use_diff) {
+        if (use_stdin || use_stdout || use_range) {
+            SPDLOG_ERROR("--check/--diff do not work with --stdin, --stdout or --range");
+            return 1;
+        }
+        // stdout 只留给会被改写的文件列表或 diff
+        UseStderrLogger();
+        try {
+            dlfmt_check_result result;
+            switch (work_mode) {
+                case dlfmt_mode::format_file: {
+                    RunStats::FileScope stats_scope(stats.get(), file_or_directory);
+                    result = CheckFile(file_or_directory, work_param, use_diff);
+                    break;
+                }
+                case dlfmt_mode::format_directory:
+                    result = CheckDirectory(file_or_directory, work_param, work_options, use_diff);
+                    break;
+                case dlfmt_mode::json_task:
+                    result = CheckJsonTask(file_or_directory, work_options, use_diff);
+                    break;
+                case dlfmt_mode::files_from:
+                    result = CheckFilesFrom(file_or_directory, work_param, work_options, use_diff);
+                    break;
+                default:
+                    SPDLOG_ERROR("--check/--diff only work with --format-file, --format-directory, --json-task or --files-from");
+                    return 1;
+            }
+            const int exit_code = ReportCheck(result, use_diff, use_check);
+            // stdout 已经留给了检查结果，json 统计写到 stderr
+            if (stats) {
+                stats->Report(stats_json, stderr);
+            }
+            return exit_code;
+        }
+        catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return 1;
+        }
+    }
+
+    if (work_options.verify && (use_stdin || use_stdout || use_range)) {
+        SPDLOG_ERROR("--verify does not work with --stdin, --stdout or --range");
+        return 1;
+    }
+    if (work_mode == dlfmt_mode::watch) {
+        if (use_stdin || use_stdout || use_range) {
+            SPDLOG_ERROR("--watch does not work with --stdin, --stdout or --range");
+            return 1;
+        }
+        try {
+            Watch(file_or_directory, work_param, work_options);
+        }
+        catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return 1;
+        }
+        return 0;
+    }
+    if (use_stdin || use_stdout) {
+        if (work_mode != dlfmt_mode::format_file && work_mode != dlfmt_mode::compress_file) {
+            SPDLOG_ERROR("--stdin/--stdout only work with --format-file or --compress-file");
+            return 1;
+        }
+        UseStderrLogger();
+        const std::string name =
+            !use_stdin ? file_or_directory
+                       : (file_or_directory.empty() || file_or_directory == "-" ? "<stdin>"
+                                                                               : file_or_directory);
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        try {
+            std::string content = ReadSource(use_stdin ? "-" : file_or_directory);
+            if (use_range) {
+                std::string output;
+                FormatRangeBuffer(std::move(content), work_param, work_range, name, output);
+                std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+            }
+            else if (work_mode == dlfmt_mode::compress_file) {
+                CompressStream(std::move(content), name, std::cout);
+            }
+            else {
+                FormatStream(std::move(content), work_param, name, std::cout);
+            }
+        }
+        catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return 1;
+        }
+        std::cout.flush();
+        return std::cout ? 0 : 1;
+    }
+
+    // json 统计独占 stdout
+    if (stats_json) {
+        UseStderrLogger();
+    }
     Timer timer;
     timer.start();
-    switch (work_mode) {
-        case dlfmt_mode::format_file:{
-			timer.setLabel(fmt::format("Formatted file '{}'", file_or_directory));
-			FormatFile(file_or_directory, work_param);
-			break;
-		}
-        case dlfmt_mode::format_directory:{
-            timer.setLabel(fmt::format("Formatted directory '{}'", file_or_directory));
-            FormatDirectory(file_or_directory, work_param);
-            break;
-        }
-        case dlfmt_mode::compress_file:{
-            timer.setLabel(fmt::format("Compressed file '{}'", file_or_directory));
-            CompressFile(file_or_directory, work_param);
-            break;
-        }
-        case dlfmt_mode::compress_directory:{
-            timer.setLabel(fmt::format("Compressed directory '{}'", file_or_directory));
-            CompressDirectory(file_or_directory, work_param);
-            break;
-        }
-        case dlfmt_mode::json_task:{
-            timer.setLabel(fmt::format("Processed json task file '{}'", file_or_directory));
-            JsonTask(file_or_directory);
-            break;
-        }
-        default:
-            SPDLOG_ERROR("No valid work mode specified.");
-            return 1;
+    int exit_code = 0;
+    try {
+        RunStats::FileScope stats_scope(
+            work_mode == dlfmt_mode::format_file || work_mode == dlfmt_mode::compress_file
+                ? stats.get()
+                : nullptr,
+            file_or_directory);
+        switch (work_mode) {
+            case dlfmt_mode::format_file:{
+				timer.setLabel(fmt::format("Formatted file '{}'", file_or_directory));
+				if (use_range) {
+					FormatFileRange(file_or_directory, work_param, work_range);
+				}
+				else {
+					FormatFile(file_or_directory,
+							   work_param,
+							   OpenResultCache(work_options).get(),
+							   work_options.verify);
+				}
+				break;
+			}
+            case dlfmt_mode::format_directory:{
+                timer.setLabel(fmt::format("Formatted directory '{}'", file_or_directory));
+                FormatDirectory(file_or_directory, work_param, work_options);
+                break;
+            }
+            case dlfmt_mode::compress_file:{
+                timer.setLabel(fmt::format("Compressed file '{}'", file_or_directory));
+                CompressFile(file_or_directory,
+                             work_param,
+                             OpenResultCache(work_options).get(),
+                             work_options.verify);
+                break;
+            }
+            case dlfmt_mode::compress_directory:{
+                timer.setLabel(fmt::format("Compressed directory '{}'", file_or_directory));
+                CompressDirectory(file_or_directory, work_param, work_options);
+                break;
+            }
+            case dlfmt_mode::json_task:{
+                timer.setLabel(fmt::format("Processed json task file '{}'", file_or_directory));
+                // 有戳记时构建系统靠退出码判断，有文件处理失败时返回 1
+                if (JsonTask(file_or_directory, work_options) != 0 && !work_options.stamp.empty()) {
+                    exit_code = 1;
+                }
+                break;
+            }
+            case dlfmt_mode::files_from:{
+                timer.setLabel(fmt::format("Processed file list '{}'", file_or_directory));
+                // 钩子靠退出码判断，有文件处理失败时返回 1
+                if (FilesFrom(file_or_directory, work_param, work_options) != 0) {
+                    exit_code = 1;
+                }
+                break;
+            }
+            default:
+                SPDLOG_ERROR("No valid work mode specified.");
+                return 1;
+        }
+    }
+    catch (const std::exception& e) {
+        SPDLOG_ERROR("{}", e.what());
+        return 1;
     }
     timer.stop();
-    timer.print();
-    return 0;
+    if (stats) {
+        stats->Report(stats_json, stdout);
+    }
+    if (!stats_json) {
+        timer.print();
+    }
+    return exit_code;
 }
\ No newline at end of file
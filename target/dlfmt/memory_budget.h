@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * @brief 按预测的峰值内存对并发处理的文件做准入控制
+ * @details 每个文件处理前按 基础开销 + 输入大小 × 膨胀系数 申请预算，预算不足时阻塞，直到别的文件
+ * 释放。预测值超过总预算的文件按总预算计，只能在没有其它文件占用预算时进入，相当于被串行处理；
+ * 小文件则可以继续在剩余预算里流动。膨胀系数从经验值开始，随后用实测的占用向上修正。
+ */
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget(size_t limit)
+		: limit_(limit)
+	{}
+
+	/**
+	 * @brief 为一个输入大小为 input_size 的文件申请预算，必要时阻塞
+	 *
+	 * @param input_size
+	 * @return size_t 实际占用的预算，需原样交给 Release
+	 */
+	size_t Acquire(size_t input_size)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		const size_t                 reserved = std::min(Predict(input_size), limit_);
+		cv_.wait(lock, [&] { return in_use_ == 0 || in_use_ + reserved <= limit_; });
+		in_use_ += reserved;
+		peak_in_use_ = std::max(peak_in_use_, in_use_);
+		return reserved;
+	}
+
+	/**
+	 * @brief 归还预算，并用实测占用修正膨胀系数
+	 *
+	 * @param reserved Acquire 的返回值
+	 * @param input_size
+	 * @param footprint 处理该文件时实测的内存占用
+	 */
+	void Release(size_t reserved, size_t input_size, size_t footprint)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			in_use_ -= reserved;
+			peak_footprint_ = std::max(peak_footprint_, footprint);
+			// 太小的文件基本只有固定开销，不参与系数修正
+			if (input_size >= MIN_SAMPLE_SIZE && footprint > BASE_OVERHEAD) {
+				const double factor = static_cast<double>(footprint - BASE_OVERHEAD) /
+									  static_cast<double>(input_size);
+				expansion_factor_   = std::max(expansion_factor_, factor);
+			}
+		}
+		cv_.notify_all();
+	}
+
+	size_t Limit() const noexcept { return limit_; }
+
+	size_t PeakInUse()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return peak_in_use_;
+	}
+
+	size_t PeakFootprint()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return peak_footprint_;
+	}
+
+	double ExpansionFactor()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return expansion_factor_;
+	}
+
+	/**
+	 * @brief RAII 形式的预算占用
+	 *
+	 */
+	class Ticket
+	{
+	public:
+		Ticket(MemoryBudget* budget, size_t input_size)
+			: budget_(budget)
+			, input_size_(input_size)
+			, reserved_(budget ? budget->Acquire(input_size) : 0)
+		{}
+		~Ticket()
+		{
+			if (budget_) {
+				budget_->Release(reserved_, input_size_, footprint_);
+			}
+		}
+		Ticket(const Ticket&)            = delete;
+		Ticket& operator=(const Ticket&) = delete;
+
+		void SetFootprint(size_t footprint) noexcept { footprint_ = footprint; }
+
+	private:
+		MemoryBudget* budget_;
+		size_t        input_size_;
+		size_t        reserved_;
+		size_t        footprint_ = 0;
+	};
+
+private:
+	size_t Predict(size_t input_size) const noexcept
+	{
+		return BASE_OVERHEAD + static_cast<size_t>(static_cast<double>(input_size) * expansion_factor_);
+	}
+
+	// 每个文件的固定开销：arena 的首个块、打印缓冲区等
+	static constexpr size_t BASE_OVERHEAD   = 512 * 1024;
+	static constexpr size_t MIN_SAMPLE_SIZE = 64 * 1024;
+
+	std::mutex              mutex_;
+	std::condition_variable cv_;
+	size_t                  limit_;
+	size_t                  in_use_           = 0;
+	size_t                  peak_in_use_      = 0;
+	size_t                  peak_footprint_   = 0;
+	double                  expansion_factor_ = 16.0;
+};
@@ -0,0 +1,229 @@
+#include "result_cache.h"
+#include "cache_store.h"
+#include "dl/xxhash.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <system_error>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#	include <process.h>
+#else
+#	include <unistd.h>
+#endif
+
+namespace {
+constexpr char     OBJECT_MAGIC[4] = {'D', 'L', 'R', 'C'};
+constexpr size_t   HEADER_SIZE     = 32;
+constexpr uint32_t FLAG_IDENTITY   = 1;
+
+template<typename T> T load(const char* p) noexcept
+{
+	T v;
+	std::memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+template<typename T> void store(std::string& out, T v)
+{
+	out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+// 用键本身做种子再算一次输入哈希，作为对象头里的校验
+uint64_t input_check(uint64_t key, std::string_view input) noexcept
+{
+	return dl::xxhash64(input, key);
+}
+
+unsigned long process_id() noexcept
+{
+#ifdef _WIN32
+	return static_cast<unsigned long>(_getpid());
+#else
+	return static_cast<unsigned long>(getpid());
+#endif
+}
+}   // namespace
+
+ResultCache::ResultCache(std::string directory, size_t max_size)
+	: directory_(std::move(directory))
+	, max_size_(max_size)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(directory_, ec);
+	if (ec) {
+		SPDLOG_WARN("Failed to create result cache directory {} ({})", directory_, ec.message());
+	}
+}
+
+ResultCache::~ResultCache()
+{
+	try {
+		Trim();
+	}
+	catch (const std::exception& e) {
+		SPDLOG_WARN("Failed to trim result cache {} ({})", directory_, e.what());
+	}
+}
+
+uint64_t ResultCache::Key(std::string_view input, std::string_view salt) noexcept
+{
+	return dl::xxhash64(input, dl::xxhash64(salt));
+}
+
+std::string ResultCache::ObjectPath(uint64_t key) const
+{
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+	return directory_ + "/" + std::string(hex, 2) + "/" + std::string(hex + 2, 14);
+}
+
+ResultCache::lookup_result ResultCache::Lookup(uint64_t key, std::string_view input,
+											   std::string& output) const
+{
+	const std::string path = ObjectPath(key);
+	std::ifstream     in(path, std::ios::binary);
+	char              header[HEADER_SIZE];
+	if (!in || !in.read(header, HEADER_SIZE) || std::memcmp(header, OBJECT_MAGIC, 4) != 0 ||
+		load<uint64_t>(header + 8) != input.size() ||
+		load<uint64_t>(header + 16) != input_check(key, input)) {
+		++misses_;
+		return lookup_result::miss;
+	}
+
+	lookup_result result = lookup_result::identity;
+	if (!(load<uint32_t>(header + 4) & FLAG_IDENTITY)) {
+		const auto output_size = load<uint64_t>(header + 24);
+		output.resize(output_size);
+		if (output_size &&
+			!in.read(&output[0], static_cast<std::streamsize>(output_size))) {
+			++misses_;
+			return lookup_result::miss;
+		}
+		result = lookup_result::hit;
+	}
+	in.close();
+
+	// 刷新 mtime，淘汰时据此判断新旧
+	std::error_code ec;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	++hits_;
+	return result;
+}
+
+void ResultCache::Store(uint64_t key, std::string_view input, std::string_view output)
+{
+	const bool identity = output == input;
+
+	std::string data;
+	data.reserve(HEADER_SIZE + (identity ? 0 : output.size()));
+	data.append(OBJECT_MAGIC, 4);
+	store(data, identity ? FLAG_IDENTITY : 0u);
+	store(data, static_cast<uint64_t>(input.size()));
+	store(data, input_check(key, input));
+	store(data, static_cast<uint64_t>(output.size()));
+	if (!identity) {
+		data.append(output);
+	}
+
+	const std::filesystem::path path(ObjectPath(key));
+	std::error_code             ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+
+	// 临时文件名带上进程号与线程号，并发写同一个对象时互不截断
+	const std::string tmp_path =
+		path.string() + ".tmp." + std::to_string(process_id()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+		out.write(data.data(), static_cast<std::streamsize>(data.size()));
+		if (!out) {
+			out.close();
+			std::filesystem::remove(tmp_path, ec);
+			return;
+		}
+	}
+	// 别的进程（或另一个工作区）可能同时未命中并写入了同一个对象，键相同时内容也相同，
+	// 覆盖不增加总量，只计入新增的对象
+	const bool replaced = std::filesystem::exists(path, ec);
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return;
+	}
+	if (!replaced) {
+		added_size_ += data.size();
+	}
+}
+
+void ResultCache::Trim()
+{
+	const size_t added = added_size_.exchange(0);
+	if (added == 0) {
+		return;
+	}
+
+	FileLock lock(directory_ + "/lock", true);
+
+	// 总量记在 size 文件里，不必每次运行都遍历目录；超出容量时才遍历并校正
+	const std::string size_path = directory_ + "/size";
+	uint64_t          total     = 0;
+	{
+		std::ifstream in(size_path);
+		in >> total;
+	}
+	total += added;
+
+	if (total > max_size_) {
+		struct object_t
+		{
+			std::filesystem::path           path;
+			uint64_t                        size;
+			std::filesystem::file_time_type mtime;
+		};
+		std::vector<object_t> objects;
+		std::error_code       ec;
+		total = 0;
+		for (const auto& bucket : std::filesystem::directory_iterator(directory_, ec)) {
+			if (!bucket.is_directory(ec)) {
+				continue;
+			}
+			for (const auto& entry : std::filesystem::directory_iterator(bucket.path(), ec)) {
+				if (!entry.is_regular_file(ec)) {
+					continue;
+				}
+				const auto size  = entry.file_size(ec);
+				const auto mtime = entry.last_write_time(ec);
+				if (!ec) {
+					objects.push_back({entry.path(), size, mtime});
+					total += size;
+				}
+			}
+		}
+		std::sort(objects.begin(), objects.end(), [](const object_t& a, const object_t& b) {
+			return a.mtime < b.mtime;
+		});
+
+		// 淘汰到容量的 90%，避免每次运行都触发遍历
+		const uint64_t target  = max_size_ / 10 * 9;
+		size_t         evicted = 0;
+		for (const auto& object : objects) {
+			if (total <= target) {
+				break;
+			}
+			if (std::filesystem::remove(object.path, ec)) {
+				total -= object.size;
+				++evicted;
+			}
+		}
+		SPDLOG_INFO("Result cache: evicted {} objects, {} bytes kept.", evicted, total);
+	}
+
+	std::ofstream out(size_path, std::ios::trunc);
+	out << total;
+}
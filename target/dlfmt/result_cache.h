@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 用户级的处理结果缓存，按内容寻址，可被多个工作区与 CI 检出共享
+ * @details 键为输入内容与 (dlfmt 版本, 处理模式) 的哈希，值为处理后的输出。每个结果是目录下的一个
+ * 对象文件 `<dir>/<前两位>/<其余位>`，先写临时文件再 rename，所以并发的进程只会看到完整的对象；
+ * 对象头里另存一份不同种子的输入哈希与长度，键碰撞或文件损坏都按未命中处理。
+ * 输出与输入相同时只存一个标记，不存内容。
+ * 命中时刷新对象的 mtime，超出容量时按 mtime 从旧到新淘汰（近似 LRU），淘汰在目录锁下进行。
+ */
+class ResultCache
+{
+public:
+	enum class lookup_result
+	{
+		miss,
+		identity,   // 输出与输入相同
+		hit
+	};
+
+	ResultCache(std::string directory, size_t max_size);
+	~ResultCache();
+	ResultCache(const ResultCache&)            = delete;
+	ResultCache& operator=(const ResultCache&) = delete;
+
+	/**
+	 * @brief 计算缓存键
+	 *
+	 * @param input 输入内容
+	 * @param salt 版本与处理模式，不同 salt 的结果互不可见
+	 */
+	static uint64_t Key(std::string_view input, std::string_view salt) noexcept;
+
+	lookup_result Lookup(uint64_t key, std::string_view input, std::string& output) const;
+
+	void Store(uint64_t key, std::string_view input, std::string_view output);
+
+	/**
+	 * @brief 把本次新增的大小计入总量，超出容量时淘汰旧对象
+	 *
+	 */
+	void Trim();
+
+	const std::string& Directory() const noexcept { return directory_; }
+	size_t             Hits() const noexcept { return hits_; }
+	size_t             Misses() const noexcept { return misses_; }
+
+private:
+	std::string ObjectPath(uint64_t key) const;
+
+	std::string                 directory_;
+	size_t                      max_size_;
+	std::atomic<size_t>         added_size_{0};
+	mutable std::atomic<size_t> hits_{0};
+	mutable std::atomic<size_t> misses_{0};
+};
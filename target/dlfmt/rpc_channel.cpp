@@ -0,0 +1,100 @@
+#include "rpc_channel.h"
+#include <charconv>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+RpcChannel::RpcChannel(std::FILE* in, std::FILE* out)
+	: in_(in)
+	, out_(out)
+{
+#ifdef _WIN32
+	// 文本模式会改写 \r\n，打乱 Content-Length
+	_setmode(_fileno(in_), _O_BINARY);
+	_setmode(_fileno(out_), _O_BINARY);
+#endif
+}
+
+bool RpcChannel::Read(std::string& body)
+{
+	size_t content_length = 0;
+	bool   has_length     = false;
+	char   line[1024];
+	while (true) {
+		if (!std::fgets(line, sizeof(line), in_)) {
+			return false;
+		}
+		size_t length = std::strlen(line);
+		while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+			line[--length] = '\0';
+		}
+		// 空行结束帧头
+		if (length == 0) {
+			if (has_length) {
+				break;
+			}
+			continue;
+		}
+		constexpr const char   HEADER[]   = "Content-Length:";
+		constexpr const size_t HEADER_LEN = sizeof(HEADER) - 1;
+		if (length > HEADER_LEN && std::strncmp(line, HEADER, HEADER_LEN) == 0) {
+			const char* first = line + HEADER_LEN;
+			const char* last  = line + length;
+			while (first != last && (*first == ' ' || *first == '\t')) {
+				++first;
+			}
+			while (last != first && (last[-1] == ' ' || last[-1] == '\t')) {
+				--last;
+			}
+			const auto [end, ec] = std::from_chars(first, last, content_length);
+			if (ec != std::errc() || end != last || first == last) {
+				SPDLOG_ERROR("Invalid message header: {}", line);
+				return false;
+			}
+			if (content_length > MAX_MESSAGE_SIZE) {
+				SPDLOG_ERROR("Message of {} bytes exceeds the {} byte limit",
+							 content_length,
+							 MAX_MESSAGE_SIZE);
+				return false;
+			}
+			has_length = true;
+		}
+		// 其它帧头（如 Content-Type）忽略
+	}
+
+	body.resize(content_length);
+	if (content_length && std::fread(&body[0], 1, content_length, in_) != content_length) {
+		SPDLOG_ERROR("Unexpected end of input while reading a {} byte message", content_length);
+		return false;
+	}
+	return true;
+}
+
+void RpcChannel::Write(const std::string& body)
+{
+	char      header[64];
+	const int header_length =
+		std::snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", body.size());
+
+	std::lock_guard<std::mutex> lock(write_mutex_);
+	std::fwrite(header, 1, static_cast<size_t>(header_length), out_);
+	std::fwrite(body.data(), 1, body.size(), out_);
+	std::fflush(out_);
+}
+
+void RpcChannel::Reply(const nlohmann::json& id, nlohmann::json result)
+{
+	const nlohmann::json response = {{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}};
+	// 源码里可能有非 UTF-8 的字节，替换掉而不是让整条回复失败
+	Write(response.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+}
+
+void RpcChannel::ReplyError(const nlohmann::json& id, int code, const std::string& message)
+{
+	const nlohmann::json response = {
+		{"jsonrpc", "2.0"}, {"id", id}, {"error", {{"code", code}, {"message", message}}}};
+	Write(response.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+}
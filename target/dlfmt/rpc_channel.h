@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdio>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+
+// JSON-RPC 2.0 的错误码
+constexpr int RPC_PARSE_ERROR      = -32700;
+constexpr int RPC_INVALID_REQUEST  = -32600;
+constexpr int RPC_METHOD_NOT_FOUND = -32601;
+constexpr int RPC_INVALID_PARAMS   = -32602;
+constexpr int RPC_PROCESS_FAILED   = -32000;
+
+/**
+ * @brief 以 `Content-Length: N\r\n\r\n<body>` 分帧的消息通道（与 LSP 的基础协议相同）
+ * @details Read 只应在一个线程里调用；Write 加锁，可以从多个工作线程并发调用
+ */
+class RpcChannel
+{
+public:
+	RpcChannel(std::FILE* in, std::FILE* out);
+
+	/**
+	 * @brief 读取一条消息
+	 *
+	 * @return false 输入结束，或帧头损坏（Content-Length 不是合法的数字或超过 MAX_MESSAGE_SIZE），
+	 * 此时应关闭连接
+	 */
+	bool Read(std::string& body);
+
+	void Write(const std::string& body);
+
+	// 单条消息的大小上限，防止损坏或恶意的帧头触发超大的分配
+	static constexpr size_t MAX_MESSAGE_SIZE = size_t{256} << 20;
+
+	void Reply(const nlohmann::json& id, nlohmann::json result);
+	void ReplyError(const nlohmann::json& id, int code, const std::string& message);
+
+private:
+	std::FILE* in_;
+	std::FILE* out_;
+	std::mutex write_mutex_;
+};
@@ -0,0 +1,250 @@
+#include "run_stats.h"
+#include <algorithm>
+#include <exception>
+#include <nlohmann/json.hpp>
+#include <omp.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+thread_local file_stats_t* current_file = nullptr;
+
+constexpr const char* PHASE_NAMES[] = {"read", "tokenize", "parse", "print", "verify", "write"};
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) ==
+			  static_cast<size_t>(stats_phase::count));
+
+// 按阶段处理的字节数算吞吐：读、分词、解析、校验按输入，打印、写出按输出
+uint64_t phase_bytes(size_t phase, uint64_t bytes_in, uint64_t bytes_out)
+{
+	const auto p = static_cast<stats_phase>(phase);
+	return p == stats_phase::print || p == stats_phase::write ? bytes_out : bytes_in;
+}
+
+double mb_per_second(uint64_t bytes, uint64_t ns)
+{
+	return ns == 0 ? 0.0 : static_cast<double>(bytes) * 1e3 / static_cast<double>(ns);
+}
+
+// 最近秩法求分位数，values 已升序
+uint64_t percentile(const std::vector<uint64_t>& values, double p)
+{
+	if (values.empty()) {
+		return 0;
+	}
+	size_t rank = static_cast<size_t>(p * static_cast<double>(values.size()) + 0.999999);
+	rank        = std::clamp<size_t>(rank, 1, values.size());
+	return values[rank - 1];
+}
+
+nlohmann::json file_to_json(const file_stats_t& file)
+{
+	nlohmann::json j;
+	j["path"]      = file.path;
+	j["total_ns"]  = file.total_ns;
+	j["bytes_in"]  = file.bytes_in;
+	j["bytes_out"] = file.bytes_out;
+	j["tokens"]    = file.tokens;
+	j["nodes"]     = file.nodes;
+	j["failed"]    = file.failed;
+	for (size_t phase = 0; phase < static_cast<size_t>(stats_phase::count); ++phase) {
+		j[std::string(PHASE_NAMES[phase]) + "_ns"] = file.phase_ns[phase];
+	}
+	return j;
+}
+}   // namespace
+
+RunStats::RunStats()
+	: buckets_(static_cast<size_t>(std::max(omp_get_max_threads(), 1)))
+	, start_(std::chrono::steady_clock::now())
+{}
+
+file_stats_t& RunStats::add_record(const std::string& path)
+{
+	const int thread = omp_get_thread_num();
+	if (omp_get_level() <= 1 && thread >= 0 && static_cast<size_t>(thread) < buckets_.size()) {
+		auto& bucket = buckets_[static_cast<size_t>(thread)];
+		bucket.emplace_back();
+		bucket.back().path = path;
+		return bucket.back();
+	}
+	std::lock_guard<std::mutex> lock(shared_mutex_);
+	shared_.emplace_back();
+	shared_.back().path = path;
+	return shared_.back();
+}
+
+RunStats::FileScope::FileScope(RunStats* stats, const std::string& path)
+	: previous_(current_file)
+{
+	if (!stats) {
+		return;
+	}
+	file_         = &stats->add_record(path);
+	uncaught_     = std::uncaught_exceptions();
+	start_        = std::chrono::steady_clock::now();
+	current_file  = file_;
+}
+
+RunStats::FileScope::~FileScope()
+{
+	if (!file_) {
+		return;
+	}
+	file_->total_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+												std::chrono::steady_clock::now() - start_)
+												.count());
+	file_->failed   = std::uncaught_exceptions() > uncaught_;
+	current_file    = previous_;
+}
+
+file_stats_t* RunStats::Current() noexcept
+{
+	return current_file;
+}
+
+void RunStats::AddInput(size_t bytes) noexcept
+{
+	if (current_file) {
+		current_file->bytes_in += bytes;
+	}
+}
+
+void RunStats::AddOutput(size_t bytes) noexcept
+{
+	if (current_file) {
+		current_file->bytes_out += bytes;
+	}
+}
+
+void RunStats::AddCounts(size_t tokens, size_t nodes) noexcept
+{
+	if (current_file) {
+		current_file->tokens += tokens;
+		current_file->nodes += nodes;
+	}
+}
+
+void RunStats::Report(bool json, std::FILE* out, size_t top_n)
+{
+	const uint64_t wall_ns = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+															 start_)
+			.count());
+
+	std::vector<file_stats_t> files;
+	for (auto& bucket : buckets_) {
+		std::move(bucket.begin(), bucket.end(), std::back_inserter(files));
+		bucket.clear();
+	}
+	std::move(shared_.begin(), shared_.end(), std::back_inserter(files));
+	shared_.clear();
+
+	constexpr size_t PHASES = static_cast<size_t>(stats_phase::count);
+	uint64_t         phase_ns[PHASES] = {};
+	uint64_t         bytes_in = 0, bytes_out = 0, tokens = 0, nodes = 0, busy_ns = 0;
+	size_t           failed = 0;
+	std::vector<uint64_t> latencies;
+	latencies.reserve(files.size());
+	for (const auto& file : files) {
+		for (size_t phase = 0; phase < PHASES; ++phase) {
+			phase_ns[phase] += file.phase_ns[phase];
+		}
+		bytes_in += file.bytes_in;
+		bytes_out += file.bytes_out;
+		tokens += file.tokens;
+		nodes += file.nodes;
+		busy_ns += file.total_ns;
+		failed += file.failed ? 1 : 0;
+		latencies.push_back(file.total_ns);
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	// 最慢的文件按耗时降序，耗时相同按路径，输出稳定
+	std::vector<const file_stats_t*> slowest;
+	slowest.reserve(files.size());
+	for (const auto& file : files) {
+		slowest.push_back(&file);
+	}
+	const size_t top = std::min(top_n, slowest.size());
+	std::partial_sort(slowest.begin(),
+					  slowest.begin() + static_cast<std::ptrdiff_t>(top),
+					  slowest.end(),
+					  [](const file_stats_t* a, const file_stats_t* b) {
+						  return a->total_ns != b->total_ns ? a->total_ns > b->total_ns
+															: a->path < b->path;
+					  });
+	slowest.resize(top);
+
+	if (json) {
+		nlohmann::json j;
+		j["files"]     = files.size();
+		j["failed"]    = failed;
+		j["wall_ns"]   = wall_ns;
+		j["busy_ns"]   = busy_ns;
+		j["bytes_in"]  = bytes_in;
+		j["bytes_out"] = bytes_out;
+		j["tokens"]    = tokens;
+		j["nodes"]     = nodes;
+		for (size_t phase = 0; phase < PHASES; ++phase) {
+			j["phases"][PHASE_NAMES[phase]] = {
+				{"ns", phase_ns[phase]},
+				{"mb_per_s",
+				 mb_per_second(phase_bytes(phase, bytes_in, bytes_out), phase_ns[phase])}};
+		}
+		j["latency_ns"] = {{"p50", percentile(latencies, 0.50)},
+						   {"p95", percentile(latencies, 0.95)},
+						   {"p99", percentile(latencies, 0.99)},
+						   {"max", latencies.empty() ? 0 : latencies.back()}};
+		j["slowest"] = nlohmann::json::array();
+		for (const auto* file : slowest) {
+			j["slowest"].push_back(file_to_json(*file));
+		}
+		std::sort(files.begin(), files.end(), [](const file_stats_t& a, const file_stats_t& b) {
+			return a.path < b.path;
+		});
+		j["per_file"] = nlohmann::json::array();
+		for (const auto& file : files) {
+			j["per_file"].push_back(file_to_json(file));
+		}
+		const std::string text = j.dump(2);
+		fwrite(text.data(), 1, text.size(), out);
+		fputc('\n', out);
+		fflush(out);
+		return;
+	}
+
+	constexpr double MiB = 1024.0 * 1024.0;
+	constexpr double ms  = 1e6;
+	SPDLOG_INFO("Stats: {} files ({} failed), {:.1f} MiB in, {:.1f} MiB out, {} tokens, {} nodes, "
+				"wall {:.1f} ms, busy {:.1f} ms.",
+				files.size(),
+				failed,
+				bytes_in / MiB,
+				bytes_out / MiB,
+				tokens,
+				nodes,
+				wall_ns / ms,
+				busy_ns / ms);
+	for (size_t phase = 0; phase < PHASES; ++phase) {
+		if (phase_ns[phase] == 0) {
+			continue;
+		}
+		SPDLOG_INFO("  {:<8} {:>10.1f} ms {:>6.1f}% {:>9.1f} MB/s",
+					PHASE_NAMES[phase],
+					phase_ns[phase] / ms,
+					busy_ns ? 100.0 * static_cast<double>(phase_ns[phase]) /
+								  static_cast<double>(busy_ns)
+							: 0.0,
+					mb_per_second(phase_bytes(phase, bytes_in, bytes_out), phase_ns[phase]));
+	}
+	SPDLOG_INFO("  latency  p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+				percentile(latencies, 0.50) / ms,
+				percentile(latencies, 0.95) / ms,
+				percentile(latencies, 0.99) / ms,
+				(latencies.empty() ? 0 : latencies.back()) / ms);
+	for (const auto* file : slowest) {
+		SPDLOG_INFO("  {:>10.2f} ms {:>9.1f} KiB {}",
+					file->total_ns / ms,
+					file->bytes_in / 1024.0,
+					file->path);
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class stats_phase
+{
+	read,
+	tokenize,
+	parse,
+	print,
+	verify,
+	write,
+	count
+};
+
+// 单个文件各阶段的耗时（纳秒）与规模
+struct file_stats_t
+{
+	std::string path;
+	uint64_t    phase_ns[static_cast<size_t>(stats_phase::count)] = {};
+	uint64_t    total_ns  = 0;
+	uint64_t    bytes_in  = 0;
+	uint64_t    bytes_out = 0;
+	uint64_t    tokens    = 0;
+	uint64_t    nodes     = 0;
+	bool        failed    = false;
+};
+
+/**
+ * @brief --stats：逐文件记录各阶段耗时与规模，结束时汇总
+ * @details 每个线程把记录追加到自己的桶里（按 omp 线程号），处理过程中没有锁与原子操作，
+ * Report 时才合并。统计点通过线程局部的“当前文件”找到记录：不在 FileScope 内，
+ * 或没有开启统计时，PhaseClock 与 Add* 只做一次指针判断
+ */
+class RunStats
+{
+public:
+	RunStats();
+	RunStats(const RunStats&)            = delete;
+	RunStats& operator=(const RunStats&) = delete;
+
+	/**
+	 * @brief 在作用域内把当前线程的统计记到 path 名下；stats 为空时什么也不做。
+	 * 作用域因异常退出时记为失败
+	 */
+	class FileScope
+	{
+	public:
+		FileScope(RunStats* stats, const std::string& path);
+		~FileScope();
+		FileScope(const FileScope&)            = delete;
+		FileScope& operator=(const FileScope&) = delete;
+
+	private:
+		file_stats_t*                         previous_ = nullptr;
+		file_stats_t*                         file_     = nullptr;
+		int                                   uncaught_ = 0;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	/**
+	 * @brief 分段计时：每次 Lap 把距上一次 Lap（或构造）的耗时计入当前文件的 phase 阶段。
+	 * 当前线程没有在统计文件时不读时钟
+	 */
+	class PhaseClock
+	{
+	public:
+		PhaseClock() noexcept
+			: file_(Current())
+		{
+			if (file_) {
+				last_ = std::chrono::steady_clock::now();
+			}
+		}
+		void Lap(stats_phase phase) noexcept
+		{
+			if (file_) {
+				const auto now = std::chrono::steady_clock::now();
+				file_->phase_ns[static_cast<size_t>(phase)] += static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count());
+				last_ = now;
+			}
+		}
+
+	private:
+		file_stats_t*                         file_;
+		std::chrono::steady_clock::time_point last_;
+	};
+
+	// 当前线程正在统计的文件，没有时为空
+	static file_stats_t* Current() noexcept;
+
+	static void AddInput(size_t bytes) noexcept;
+	static void AddOutput(size_t bytes) noexcept;
+	static void AddCounts(size_t tokens, size_t nodes) noexcept;
+
+	/**
+	 * @brief 合并各线程的记录并输出：文本形式经日志输出，json 形式写到 out
+	 * @param top_n 列出最慢的文件数
+	 */
+	void Report(bool json, std::FILE* out, size_t top_n = 10);
+
+private:
+	// 记录追加到当前线程的桶，返回新记录
+	file_stats_t& add_record(const std::string& path);
+
+	// 每个线程一个桶；用 deque 是因为追加时不移动已有的记录，嵌套的 FileScope 持有的指针保持有效
+	std::vector<std::deque<file_stats_t>> buckets_;
+	// 线程号超出预先分配的桶时（嵌套并行等）共用的桶
+	std::deque<file_stats_t>              shared_;
+	std::mutex                            shared_mutex_;
+	std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,247 @@
+#include "server.h"
+#include "dl/document.h"
+#include "dlfmt_core.h"
+#include "rpc_channel.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace {
+/**
+ * @brief 固定大小的线程池，析构时处理完队列里剩下的任务
+ *
+ */
+class WorkerPool
+{
+public:
+	explicit WorkerPool(size_t thread_count)
+	{
+		for (size_t i = 0; i < thread_count; ++i) {
+			workers_.emplace_back([this] { Run(); });
+		}
+	}
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_all();
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+	WorkerPool(const WorkerPool&)            = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push(std::move(job));
+		}
+		cv_.notify_one();
+	}
+
+private:
+	void Run()
+	{
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+				if (jobs_.empty()) {
+					return;
+				}
+				job = std::move(jobs_.front());
+				jobs_.pop();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread>          workers_;
+	std::queue<std::function<void()>> jobs_;
+	std::mutex                        mutex_;
+	std::condition_variable           cv_;
+	bool                              stopping_ = false;
+};
+
+/**
+ * @brief 按文档名保留最近格式化过的 dl::Document
+ * @details 同名的新请求与上次的源码比较公共前后缀，中间不同的部分作为一次编辑交给 Document，
+ * 只重新解析、重新打印改动过的顶层语句。同名请求串行处理，不同文档之间互不影响
+ */
+class DocumentStore
+{
+public:
+	void Format(const std::string& name, dlfmt_param param, std::string&& text, std::string& output)
+	{
+		const auto                  entry = Acquire(name);
+		std::lock_guard<std::mutex> lock(entry->mutex);
+		if (!entry->document || entry->param != param) {
+			dl::FormatOptions options;
+			options.mode    = param == dlfmt_param::manual_format ? dl::FormatMode::Manual
+																  : dl::FormatMode::Auto;
+			options.name    = name;
+			entry->document = std::make_unique<dl::Document>(text, options);
+			entry->param    = param;
+		}
+		else {
+			const std::string& old_text = entry->text;
+			const size_t       limit    = std::min(old_text.size(), text.size());
+			size_t             prefix   = 0;
+			while (prefix < limit && old_text[prefix] == text[prefix]) {
+				++prefix;
+			}
+			size_t suffix = 0;
+			while (suffix < limit - prefix &&
+				   old_text[old_text.size() - 1 - suffix] == text[text.size() - 1 - suffix]) {
+				++suffix;
+			}
+			if (prefix + suffix < std::max(old_text.size(), text.size())) {
+				entry->document->Edit(
+					prefix,
+					old_text.size() - prefix - suffix,
+					std::string_view(text).substr(prefix, text.size() - prefix - suffix));
+			}
+		}
+		// 出错时 Document 也已收下这次编辑，下次仍与这份源码比较
+		entry->text = std::move(text);
+		entry->document->Format(output);
+	}
+
+private:
+	// 最多保留的文档数，超过后丢弃最久没用过的
+	static constexpr size_t MAX_DOCUMENTS = 64;
+
+	struct Entry
+	{
+		std::mutex                    mutex;
+		std::unique_ptr<dl::Document> document;
+		std::string                   text;
+		dlfmt_param                   param     = dlfmt_param::auto_format;
+		uint64_t                      last_used = 0;
+	};
+
+	std::shared_ptr<Entry> Acquire(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto&                       slot = entries_[name];
+		if (!slot) {
+			slot = std::make_shared<Entry>();
+		}
+		slot->last_used = ++clock_;
+		auto entry      = slot;
+		if (entries_.size() > MAX_DOCUMENTS) {
+			auto oldest = entries_.begin();
+			for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+				if (it->second->last_used < oldest->second->last_used) {
+					oldest = it;
+				}
+			}
+			entries_.erase(oldest);
+		}
+		return entry;
+	}
+
+	std::mutex                                              mutex_;
+	std::unordered_map<std::string, std::shared_ptr<Entry>> entries_;
+	uint64_t                                                clock_ = 0;
+};
+
+void HandleRequest(RpcChannel& channel, DocumentStore& store, const json& request)
+{
+	const json id = request.contains("id") ? request["id"] : json();
+	// 每个工作线程复用自己的输出缓冲区
+	thread_local std::string output;
+	try {
+		const std::string method = request.at("method").get<std::string>();
+		const json        params = request.contains("params") ? request["params"] : json::object();
+		const std::string name   = params.value("name", std::string("<buffer>"));
+		if (method == "format") {
+			const std::string mode = params.value("mode", std::string("auto"));
+			if (mode != "auto" && mode != "manual") {
+				channel.ReplyError(id, RPC_INVALID_PARAMS, "Unknown mode: " + mode);
+				return;
+			}
+			const dlfmt_param param =
+				mode == "manual" ? dlfmt_param::manual_format : dlfmt_param::auto_format;
+			// 带名字的请求多半是同一个文件的反复保存，交给 DocumentStore 增量处理
+			if (params.contains("name")) {
+				store.Format(name, param, params.at("text").get<std::string>(), output);
+			}
+			else {
+				FormatBuffer(params.at("text").get<std::string>(), param, name, output);
+			}
+		}
+		else if (method == "compress") {
+			CompressBuffer(params.at("text").get<std::string>(), name, output);
+		}
+		else {
+			channel.ReplyError(id, RPC_METHOD_NOT_FOUND, "Method not found: " + method);
+			return;
+		}
+		channel.Reply(id, {{"text", output}});
+	}
+	catch (const json::exception& e) {
+		channel.ReplyError(id, RPC_INVALID_PARAMS, e.what());
+	}
+	catch (const std::exception& e) {
+		channel.ReplyError(id, RPC_PROCESS_FAILED, e.what());
+	}
+}
+}   // namespace
+
+int RunServer()
+{
+	RpcChannel    channel(stdin, stdout);
+	DocumentStore store;
+	json          shutdown_id;
+	bool          shutdown = false;
+	std::string   body;
+	{
+		WorkerPool pool(static_cast<size_t>(std::max(1, omp_get_max_threads())));
+		while (channel.Read(body)) {
+			json request = json::parse(body, nullptr, false);
+			if (request.is_discarded() || !request.is_object()) {
+				channel.ReplyError(json(), RPC_PARSE_ERROR, "Parse error");
+				continue;
+			}
+			if (!request.contains("method") || !request["method"].is_string()) {
+				channel.ReplyError(request.contains("id") ? request["id"] : json(),
+								   RPC_INVALID_REQUEST,
+								   "Invalid request: method must be a string");
+				continue;
+			}
+			const std::string method = request["method"].get<std::string>();
+			if (method == "shutdown") {
+				shutdown_id = request.contains("id") ? request["id"] : json();
+				shutdown    = true;
+				break;
+			}
+			if (method == "exit") {
+				break;
+			}
+			pool.Submit([&channel, &store, request = std::move(request)] {
+				HandleRequest(channel, store, request);
+			});
+		}
+	}
+	// 线程池析构时已处理完所有请求
+	if (shutdown) {
+		channel.Reply(shutdown_id, json());
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/**
+ * @brief 常驻模式：从 stdin 读取请求，把结果写到 stdout，直到收到 shutdown / exit 或输入结束
+ * @details 消息按 `Content-Length` 分帧，内容为 JSON-RPC 2.0：
+ * - `format`   params: {"text": 源码, "mode": "auto" | "manual", "name": 报错用的名字（可选）}
+ * - `compress` params: {"text": 源码, "name": 可选}
+ * 两者的结果均为 {"text": 处理后的源码}。请求交给线程池并发处理，回复的顺序不保证与请求一致。
+ * 带 name 的 format 请求会保留该文档的解析与打印结果，下次同名请求只重新处理改动过的顶层语句。
+ * - `shutdown` 等待已收到的请求处理完后回复并退出；`exit` 通知直接退出
+ *
+ * @return int 进程退出码
+ */
+int RunServer();
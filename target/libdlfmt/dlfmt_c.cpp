@@ -0,0 +1,87 @@
+#include "dl/dlfmt.h"
+#include "dl/formatter.h"
+#include "dl/version.h"
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+
+// 复制到 malloc 分配的缓冲区，交给调用方用 dlfmt_free 释放
+static char* CopyOut(const std::string& text)
+{
+	char* buffer = static_cast<char*>(std::malloc(text.size() + 1));
+	if (buffer) {
+		std::memcpy(buffer, text.data(), text.size());
+		buffer[text.size()] = '\0';
+	}
+	return buffer;
+}
+
+static void SetError(char** error, const char* message)
+{
+	if (error) {
+		*error = CopyOut(message);
+	}
+}
+
+extern "C" dlfmt_status dlfmt_format_buffer(const char* input, size_t input_size,
+											dlfmt_format_mode mode, const char* name,
+											char** output, size_t* output_size, char** error)
+{
+	if (error) {
+		*error = nullptr;
+	}
+	if (!output || (!input && input_size)) {
+		SetError(error, "invalid argument");
+		return DLFMT_INVALID_ARGUMENT;
+	}
+	*output = nullptr;
+
+	dl::FormatOptions options;
+	switch (mode) {
+	case DLFMT_MODE_AUTO: options.mode = dl::FormatMode::Auto; break;
+	case DLFMT_MODE_MANUAL: options.mode = dl::FormatMode::Manual; break;
+	case DLFMT_MODE_COMPRESS: options.mode = dl::FormatMode::Compress; break;
+	default: SetError(error, "unknown mode"); return DLFMT_INVALID_ARGUMENT;
+	}
+	if (name) {
+		options.name = name;
+	}
+
+	// 异常不能越过 C ABI
+	try {
+		std::string result;
+		dl::Formatter::Format(std::string_view(input ? input : "", input_size), options, result);
+		*output = CopyOut(result);
+		if (!*output) {
+			SetError(error, "out of memory");
+			return DLFMT_INTERNAL_ERROR;
+		}
+		if (output_size) {
+			*output_size = result.size();
+		}
+		return DLFMT_OK;
+	}
+	catch (const dl::SyntaxError& e) {
+		SetError(error, e.what());
+		return DLFMT_SYNTAX_ERROR;
+	}
+	catch (const std::exception& e) {
+		SetError(error, e.what());
+		return DLFMT_INTERNAL_ERROR;
+	}
+	catch (...) {
+		SetError(error, "unknown error");
+		return DLFMT_INTERNAL_ERROR;
+	}
+}
+
+extern "C" void dlfmt_free(char* buffer)
+{
+	std::free(buffer);
+}
+
+extern "C" const char* dlfmt_version(void)
+{
+	return dl::VERSION;
+}
@@ -0,0 +1,164 @@
+#include "dl/formatter.h"
+#include <node_api.h>
+#include <exception>
+#include <string>
+
+/**
+ * @brief Node-API 插件：formatBuffer(text, mode?, name?) / compressBuffer(text, name?)
+ * @details 两个函数都返回 Promise，处理在 libuv 的工作线程上进行，不阻塞扩展宿主的事件循环。
+ * 语法错误以 Error 拒绝，附带 line 属性
+ */
+namespace {
+struct format_work_t
+{
+	napi_async_work  work     = nullptr;
+	napi_deferred    deferred = nullptr;
+	std::string      input;
+	std::string      output;
+	dl::FormatOptions options;
+	// 出错时 error 非空；is_syntax_error 为真时 line 有效
+	std::string error;
+	bool        is_syntax_error = false;
+	size_t      line            = 0;
+};
+
+#define NAPI_CALL(env, call)                                                                       \
+	do {                                                                                           \
+		if ((call) != napi_ok) {                                                                   \
+			napi_throw_error((env), nullptr, "dlfmt: " #call " failed");                           \
+			return nullptr;                                                                        \
+		}                                                                                          \
+	} while (0)
+
+bool GetString(napi_env env, napi_value value, std::string& out)
+{
+	size_t length = 0;
+	if (napi_get_value_string_utf8(env, value, nullptr, 0, &length) != napi_ok) {
+		return false;
+	}
+	out.resize(length);
+	// 第四个参数包括结尾的 '\0'
+	return napi_get_value_string_utf8(env, value, &out[0], length + 1, &length) == napi_ok;
+}
+
+void Execute(napi_env /*env*/, void* data)
+{
+	// 工作线程上不能调用任何 napi 函数
+	auto* work = static_cast<format_work_t*>(data);
+	try {
+		dl::Formatter::Format(std::move(work->input), work->options, work->output);
+	}
+	catch (const dl::SyntaxError& e) {
+		work->error           = e.what();
+		work->is_syntax_error = true;
+		work->line            = e.Line();
+	}
+	catch (const std::exception& e) {
+		work->error = e.what();
+	}
+}
+
+void Complete(napi_env env, napi_status status, void* data)
+{
+	auto* work = static_cast<format_work_t*>(data);
+	if (status != napi_ok && work->error.empty()) {
+		work->error = "dlfmt: async work cancelled";
+	}
+	napi_value result;
+	if (work->error.empty()) {
+		napi_create_string_utf8(env, work->output.data(), work->output.size(), &result);
+		napi_resolve_deferred(env, work->deferred, result);
+	}
+	else {
+		napi_value message;
+		napi_create_string_utf8(env, work->error.data(), work->error.size(), &message);
+		napi_create_error(env, nullptr, message, &result);
+		if (work->is_syntax_error) {
+			napi_value line;
+			napi_create_uint32(env, static_cast<uint32_t>(work->line), &line);
+			napi_set_named_property(env, result, "line", line);
+		}
+		napi_reject_deferred(env, work->deferred, result);
+	}
+	napi_delete_async_work(env, work->work);
+	delete work;
+}
+
+// 排队一次处理；argv[0] 是源码，argv[name_index] 是可选的文件名
+napi_value Queue(napi_env env, napi_value* argv, size_t argc, size_t name_index,
+				 dl::FormatMode mode)
+{
+	auto* work         = new format_work_t;
+	work->options.mode = mode;
+	if (argc < 1 || !GetString(env, argv[0], work->input)) {
+		delete work;
+		napi_throw_type_error(env, nullptr, "dlfmt: text must be a string");
+		return nullptr;
+	}
+	napi_valuetype type = napi_undefined;
+	if (argc > name_index && napi_typeof(env, argv[name_index], &type) == napi_ok &&
+		type == napi_string) {
+		GetString(env, argv[name_index], work->options.name);
+	}
+
+	napi_value promise;
+	napi_value resource_name;
+	if (napi_create_promise(env, &work->deferred, &promise) != napi_ok ||
+		napi_create_string_utf8(env, "dlfmt", NAPI_AUTO_LENGTH, &resource_name) != napi_ok ||
+		napi_create_async_work(
+			env, nullptr, resource_name, Execute, Complete, work, &work->work) != napi_ok ||
+		napi_queue_async_work(env, work->work) != napi_ok) {
+		if (work->work) {
+			napi_delete_async_work(env, work->work);
+		}
+		delete work;
+		napi_throw_error(env, nullptr, "dlfmt: failed to queue work");
+		return nullptr;
+	}
+	return promise;
+}
+
+napi_value FormatBuffer(napi_env env, napi_callback_info info)
+{
+	size_t     argc = 3;
+	napi_value argv[3];
+	NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+	dl::FormatMode mode = dl::FormatMode::Auto;
+	std::string    mode_name;
+	napi_valuetype type = napi_undefined;
+	if (argc > 1 && napi_typeof(env, argv[1], &type) == napi_ok && type == napi_string &&
+		GetString(env, argv[1], mode_name)) {
+		if (mode_name == "manual") {
+			mode = dl::FormatMode::Manual;
+		}
+		else if (mode_name != "auto") {
+			napi_throw_range_error(env, nullptr, ("dlfmt: unknown mode " + mode_name).c_str());
+			return nullptr;
+		}
+	}
+	return Queue(env, argv, argc, 2, mode);
+}
+
+napi_value CompressBuffer(napi_env env, napi_callback_info info)
+{
+	size_t     argc = 2;
+	napi_value argv[2];
+	NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+	return Queue(env, argv, argc, 1, dl::FormatMode::Compress);
+}
+
+napi_value Init(napi_env env, napi_value exports)
+{
+	const napi_property_descriptor properties[] = {
+		{"formatBuffer", nullptr, FormatBuffer, nullptr, nullptr, nullptr, napi_default, nullptr},
+		{"compressBuffer", nullptr, CompressBuffer, nullptr, nullptr, nullptr, napi_default, nullptr},
+	};
+	NAPI_CALL(env,
+			  napi_define_properties(
+				  env, exports, sizeof(properties) / sizeof(properties[0]), properties));
+	return exports;
+}
+}   // namespace
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)